@@ -0,0 +1,78 @@
+package main
+
+import (
+	"strings"
+
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+)
+
+// pollBatch holds the results of the statements a poll sends in a single
+// round-trip: the replication status query, followed by the queries of
+// each batch collector.
+type pollBatch struct {
+	replication    *gomysql.Result
+	replicationErr error
+
+	// collectors is indexed as the target's collectors. Entries of
+	// collectors which were not batched, or whose statements were not
+	// executed, are nil and the collectors query on their own.
+	collectors []*batchResults
+}
+
+// batchResults holds the results of the queries of a batch collector, or
+// the error of the statement which failed among them.
+type batchResults struct {
+	results []*gomysql.Result
+	err     error
+}
+
+// queryBatch sends the queries of a poll as one multi-statement query.
+// When the server does not accept multiple statements, only the
+// replication status is queried.
+func (tg *target) queryBatch(db *mysql.Conn) *pollBatch {
+	b := &pollBatch{collectors: make([]*batchResults, len(tg.collectors))}
+
+	if !db.Capability(gomysql.CLIENT_MULTI_STATEMENTS) {
+		b.replication, b.replicationErr = db.ExecuteReuse(tg.replicationQuery, tg.replicationResult)
+		return b
+	}
+
+	statements := []string{strings.TrimRight(tg.replicationQuery, "; \t\n")}
+	for _, c := range tg.collectors {
+		if bc, ok := c.(batchCollector); ok {
+			statements = append(statements, bc.queries()...)
+		}
+	}
+
+	// Only the replication status result is reused: collectors may keep
+	// strings pointing into the memory of their results.
+	results, err := db.ExecuteMulti(strings.Join(statements, ";"), []*gomysql.Result{tg.replicationResult})
+	if len(results) == 0 {
+		b.replicationErr = err
+		return b
+	}
+	b.replication, results = results[0], results[1:]
+
+	for i, c := range tg.collectors {
+		bc, ok := c.(batchCollector)
+		if !ok {
+			continue
+		}
+
+		n := len(bc.queries())
+		if len(results) < n {
+			// One of the collector's statements failed, the server
+			// did not execute the following ones.
+			if err != nil {
+				b.collectors[i] = &batchResults{err: err}
+			}
+			break
+		}
+
+		b.collectors[i] = &batchResults{results: results[:n]}
+		results = results[n:]
+	}
+
+	return b
+}
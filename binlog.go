@@ -0,0 +1,238 @@
+package main
+
+import (
+	"fmt"
+	"strconv"
+	"strings"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+)
+
+// binlogCoordinates maps (file, position) pairs of a primary's binary logs
+// onto a monotonic byte offset. The final size of a file is not known from
+// a replica, so a file is assumed to end at the furthest position seen in
+// it, and the next file to start there. When a further position shows up
+// later, such as the executed position catching up with a file the read
+// position already left, the following files are moved along, so that
+// offsets never go backwards. Bytes written to a file after its last
+// sample are not accounted for until then, but read and executed
+// positions share the same coordinates, so backlogs remain consistent.
+type binlogCoordinates struct {
+	starts map[int64]int64
+	// ends holds the furthest position seen in each file.
+	ends     map[int64]int64
+	lastFile int64
+}
+
+// offset returns the monotonic offset of pos in file, registering file if
+// it follows the last one. It reports false for files older than the
+// first one seen.
+func (c *binlogCoordinates) offset(file, pos int64) (int64, bool) {
+	if c.starts == nil {
+		c.starts = map[int64]int64{file: 0}
+		c.ends = map[int64]int64{file: 0}
+		c.lastFile = file
+	}
+
+	if file > c.lastFile {
+		c.starts[file] = c.starts[c.lastFile] + c.ends[c.lastFile]
+		c.ends[file] = 0
+		c.lastFile = file
+	}
+
+	start, ok := c.starts[file]
+	if !ok {
+		return 0, false
+	}
+
+	if end := c.ends[file]; pos > end {
+		for f := range c.starts {
+			if f > file {
+				c.starts[f] += pos - end
+			}
+		}
+		c.ends[file] = pos
+	}
+
+	return start + pos, true
+}
+
+// forget drops the coordinates of files older than file.
+func (c *binlogCoordinates) forget(file int64) {
+	for f := range c.starts {
+		if f < file {
+			delete(c.starts, f)
+			delete(c.ends, f)
+		}
+	}
+}
+
+// binlogChannel holds the coordinates and last offsets of a replication
+// connection, for rate computations.
+type binlogChannel struct {
+	coords  binlogCoordinates
+	read    int64
+	exec    int64
+	sampled time.Time
+	poll    uint64
+
+	// serverID and execFile identify the binary logs the coordinates
+	// belong to, see reset.
+	serverID int64
+	execFile int64
+}
+
+// reset starts the coordinates and rates over when the primary changed,
+// or when its binary logs went backwards, such as after RESET MASTER or
+// a failover to a primary with fewer files.
+func (ch *binlogChannel) reset(serverID, execFile int64) {
+	if ch.coords.starts != nil && serverID == ch.serverID && execFile >= ch.execFile {
+		ch.execFile = execFile
+		return
+	}
+
+	*ch = binlogChannel{poll: ch.poll, serverID: serverID, execFile: execFile}
+}
+
+// binlogFileIndex returns the numeric extension of a binary log file name.
+func binlogFileIndex(name string) (int64, error) {
+	i := strings.LastIndexByte(name, '.')
+	if i < 0 {
+		return 0, fmt.Errorf("invalid binary log file name %q", name)
+	}
+
+	return strconv.ParseInt(name[i+1:], 10, 64)
+}
+
+// binlogEvents builds the binary log throughput and backlog events of the
+// replication connection at row i, alongside its replication event: the
+// rates at which the primary's binary log is read and executed, the bytes
+// read but not yet executed and the relay log space.
+func (tg *target) binlogEvents(rs *gomysql.Resultset, i int, cols *replicationColumns,
+	repl *raidman.Event, t time.Time) []*raidman.Event {
+	readFile, err := rs.ColumnString(i, cols.masterLogFile)
+	if err != nil || readFile == "" {
+		return nil
+	}
+
+	readIndex, err1 := binlogFileIndex(readFile)
+	execFile, _ := rs.ColumnString(i, cols.relayMasterLogFile)
+	execIndex, err2 := binlogFileIndex(execFile)
+	readPos, err3 := rs.ColumnInt64(i, cols.readMasterLogPos)
+	execPos, err4 := rs.ColumnInt64(i, cols.execMasterLogPos)
+	relaySpace, err5 := rs.ColumnInt64(i, cols.relayLogSpace)
+	// Master_Server_Id is missing from old servers, which then never
+	// reset on failovers.
+	serverID, _ := rs.ColumnInt64(i, cols.masterServerID)
+	for _, err := range []error{err1, err2, err3, err4, err5} {
+		if err != nil {
+			tg.log.Warn("unable to retrieve binary log positions", "service", repl.Service, "error", err)
+			return nil
+		}
+	}
+
+	ch, ok := tg.binlogChannels[repl.Service]
+	if !ok {
+		ch = new(binlogChannel)
+		tg.binlogChannels[repl.Service] = ch
+	}
+	ch.poll = tg.binlogPoll
+	ch.reset(serverID, execIndex)
+
+	event := func(name string, metric interface{}) *raidman.Event {
+		return &raidman.Event{
+			Time:    repl.Time,
+			Service: repl.Service + "/binlog/" + name,
+			State:   "ok",
+			Metric:  metric,
+		}
+	}
+
+	events := []*raidman.Event{event("relay_log_space", relaySpace)}
+
+	// Register the executed position first, it may move the start of
+	// the file being read.
+	exec, ok := ch.coords.offset(execIndex, execPos)
+	if !ok {
+		// Executing a file which predates the first poll.
+		return events
+	}
+	read, _ := ch.coords.offset(readIndex, readPos)
+	ch.coords.forget(execIndex)
+
+	events = append(events, event("backlog", read-exec))
+
+	if !ch.sampled.IsZero() && read >= ch.read && exec >= ch.exec {
+		elapsed := t.Sub(ch.sampled).Seconds()
+		events = append(events,
+			event("read_rate", float64(read-ch.read)/elapsed),
+			event("apply_rate", float64(exec-ch.exec)/elapsed))
+	}
+	ch.read, ch.exec, ch.sampled = read, exec, t
+
+	tg.log.Debug("gathered binlog positions",
+		"service", repl.Service,
+		"read", read,
+		"exec", exec,
+		"relay_log_space", relaySpace)
+
+	return events
+}
+
+// pruneBinlogChannels forgets connections which were not seen during the
+// last poll, and starts a new poll.
+func (tg *target) pruneBinlogChannels() {
+	for service, ch := range tg.binlogChannels {
+		if ch.poll != tg.binlogPoll {
+			delete(tg.binlogChannels, service)
+		}
+	}
+	tg.binlogPoll++
+}
+
+// primaryBinlogEvents builds the binary log size and write rate events of
+// a primary from SHOW BINARY LOGS. The write rate is summed over per-file
+// growth, so that purged files do not show as negative throughput.
+func (tg *target) primaryBinlogEvents(db *mysql.Conn, t time.Time) []*raidman.Event {
+	r, err := db.Execute("SHOW BINARY LOGS")
+	if err != nil {
+		tg.log.Debug("unable to list binary logs", "error", err)
+		return nil
+	}
+
+	var total, written int64
+	sizes := make(map[string]int64, r.Resultset.RowNumber())
+	for i := 0; i < r.Resultset.RowNumber(); i++ {
+		name, err := r.Resultset.GetString(i, 0)
+		if err != nil {
+			return nil
+		}
+		size, err := r.Resultset.GetInt(i, 1)
+		if err != nil {
+			return nil
+		}
+
+		name = string([]byte(name))
+		sizes[name] = size
+		total += size
+		if prev, ok := tg.binlogSizes[name]; ok {
+			written += size - prev
+		} else {
+			written += size
+		}
+	}
+
+	events := []*raidman.Event{newMetricEvent(t, "mysql/binlog/size", total)}
+	if tg.binlogSizes != nil {
+		events = append(events, newMetricEvent(t, "mysql/binlog/write_rate",
+			float64(written)/t.Sub(tg.binlogSampled).Seconds()))
+	}
+	tg.binlogSizes, tg.binlogSampled = sizes, t
+
+	tg.log.Debug("gathered binary logs", "files", len(sizes), "size", total, "written", written)
+
+	return events
+}
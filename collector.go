@@ -0,0 +1,153 @@
+package main
+
+import (
+	"fmt"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+	"gopkg.in/inconshreveable/log15.v2"
+)
+
+// A collector gathers a family of metrics on each poll, in addition to
+// replication status. Collectors are only ever called from the polling
+// loop and may keep state between polls.
+type collector interface {
+	name() string
+	collect(db *mysql.Conn, t time.Time) ([]*raidman.Event, error)
+}
+
+// A batchCollector gathers its metrics from the results of fixed queries,
+// which the polling loop sends along with the replication status query in
+// a single round-trip when the server accepts multiple statements.
+type batchCollector interface {
+	collector
+	queries() []string
+	process(results []*gomysql.Result, t time.Time) ([]*raidman.Event, error)
+}
+
+// executeAll runs queries one at a time, for batch collectors which are
+// not batched.
+func executeAll(db *mysql.Conn, queries []string) ([]*gomysql.Result, error) {
+	results := make([]*gomysql.Result, len(queries))
+	for i, query := range queries {
+		r, err := db.Execute(query)
+		if err != nil {
+			return nil, err
+		}
+		results[i] = r
+	}
+	return results, nil
+}
+
+// collectorSettings holds the settings of a [collector <name>] section.
+type collectorSettings map[string]string
+
+// availableCollectors maps the names accepted by the `collectors` setting
+// to collector constructors, which are given the logger of their target.
+var availableCollectors = map[string]func(collectorSettings, log15.Logger) (collector, error){
+	"innodb":      newInnodbCollector,
+	"digest":      newDigestCollector,
+	"processlist": newProcesslistCollector,
+	"tablesize":   newTableSizeCollector,
+	"workers":     newWorkersCollector,
+}
+
+// newCollectors builds fresh collector instances, so that each target
+// keeps its own collector state, logging through logger.
+func newCollectors(names []string, settings map[string]collectorSettings, logger log15.Logger) ([]collector, error) {
+	var cs []collector
+
+	for _, name := range names {
+		newCollector, ok := availableCollectors[name]
+		if !ok {
+			return nil, fmt.Errorf("unknown collector %q", name)
+		}
+
+		c, err := newCollector(settings[name], logger.New("collector", name))
+		if err != nil {
+			return nil, fmt.Errorf("collector %q: %s", name, err)
+		}
+		cs = append(cs, c)
+	}
+
+	return cs, nil
+}
+
+// noSettings is the settings check of collectors which have none.
+func noSettings(settings collectorSettings) error {
+	for k := range settings {
+		return fmt.Errorf("unsupported setting %q", k)
+	}
+	return nil
+}
+
+// runCollectors gathers the events of all the target's collectors, from
+// the results of their batched queries when there are. A failing collector
+// is reported with an unknown state event on its own service.
+func (tg *target) runCollectors(db *mysql.Conn, batched []*batchResults, t time.Time) []*raidman.Event {
+	var events []*raidman.Event
+
+	for i, c := range tg.collectors {
+		tg.log.Debug("running collector", "collector", c.name())
+
+		var (
+			ev  []*raidman.Event
+			err error
+		)
+		switch b := batched[i]; {
+		case b == nil:
+			ev, err = c.collect(db, t)
+		case b.err != nil:
+			err = b.err
+		default:
+			ev, err = c.(batchCollector).process(b.results, t)
+		}
+		if err != nil {
+			tg.log.Warn("unable to run collector", "collector", c.name(), "error", err)
+			event := newEvent(t, "mysql/"+c.name())
+			event.State = "unknown"
+			event.Description = fmt.Sprintf("unable to run %s collector: %s", c.name(), err)
+			events = append(events, event)
+			continue
+		}
+
+		events = append(events, ev...)
+	}
+
+	return events
+}
+
+// newEvent returns an ok event for service. Host, tags and TTL are set
+// by the target before sending.
+func newEvent(t time.Time, service string) *raidman.Event {
+	return &raidman.Event{
+		Time:    t.Unix(),
+		Service: service,
+		State:   "ok",
+	}
+}
+
+// newMetricEvent returns an ok event for service carrying metric.
+func newMetricEvent(t time.Time, service string, metric interface{}) *raidman.Event {
+	event := newEvent(t, service)
+	event.Metric = metric
+	return event
+}
+
+// rowInt converts a value of a streamed text result row to an integer.
+func rowInt(v interface{}) (int64, error) {
+	switch n := v.(type) {
+	case int64:
+		return n, nil
+	case uint64:
+		return int64(n), nil
+	case []byte:
+		return gomysql.ParseInt64(n)
+	case nil:
+		return 0, nil
+	default:
+		return 0, fmt.Errorf("unexpected integer type %T", v)
+	}
+}
@@ -0,0 +1,500 @@
+package main
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"os"
+	"strconv"
+	"strings"
+	"time"
+)
+
+var errUnknownSetting = errors.New("unknown setting")
+
+// targetConfig holds the settings of a monitored MySQL server. Settings of
+// the global section are the defaults of all targets.
+type targetConfig struct {
+	name string
+
+	mysqlHost     string
+	mysqlPort     string
+	mysqlUser     string
+	mysqlPassword string
+	mysqlDatabase string
+	// mysqlSocket is preferred over mysqlHost and mysqlPort, which are
+	// only used as a fallback. Socket targets have no mysqlHost.
+	mysqlSocket string
+
+	// tls is either empty, "true" or "skip-verify".
+	tls     string
+	tlsCA   string
+	tlsCert string
+	tlsKey  string
+
+	// compress enables the compressed protocol over TCP.
+	compress bool
+
+	hostname     string
+	tags         []string
+	interval     time.Duration
+	minInterval  time.Duration
+	lagThreshold int64
+	delay        float64
+	timeout      time.Duration
+
+	connectTimeout time.Duration
+
+	replicationQuery   string
+	heartbeatTable     string
+	heartbeatFrequency time.Duration
+	lagSampleInterval  time.Duration
+
+	collectors []string
+}
+
+// config is the result of parsing a configuration file.
+type config struct {
+	riemannHost string
+	riemannPort string
+
+	// Graphite and StatsD sinks are disabled when their host is empty.
+	graphiteHost string
+	graphitePort string
+	statsdHost   string
+	statsdPort   string
+
+	// defaults holds the settings of the global section, which
+	// discovered targets start from.
+	defaults *targetConfig
+	targets  []*targetConfig
+
+	// metricsListen is the address of the Prometheus endpoint, which is
+	// disabled when empty.
+	metricsListen string
+
+	// dialConcurrency bounds the connections dialed at once.
+	dialConcurrency int
+
+	// targetDir and targetSockets are the sources of discovered targets.
+	targetDir     string
+	targetSockets string
+
+	// collectorSettings holds the settings of [collector <name>] sections.
+	collectorSettings map[string]collectorSettings
+}
+
+func defaultConfig() *config {
+	defaults := defaultTargetConfig()
+
+	return &config{
+		riemannHost:       "localhost",
+		riemannPort:       "5555",
+		graphitePort:      "2003",
+		statsdPort:        "8125",
+		dialConcurrency:   defaultDialConcurrency,
+		defaults:          defaults,
+		targets:           []*targetConfig{defaults},
+		collectorSettings: make(map[string]collectorSettings),
+	}
+}
+
+func defaultTargetConfig() *targetConfig {
+	return &targetConfig{
+		name:               "default",
+		mysqlHost:          "localhost",
+		mysqlPort:          "3306",
+		mysqlUser:          "root",
+		mysqlPassword:      "root",
+		interval:           time.Second * 30,
+		lagThreshold:       5,
+		delay:              2.0,
+		connectTimeout:     time.Second * 10,
+		replicationQuery:   "SHOW ALL SLAVES STATUS",
+		heartbeatFrequency: time.Second,
+	}
+}
+
+// set applies a target setting, it returns errUnknownSetting for keys
+// which are not target settings.
+func (c *targetConfig) set(k, v string) error {
+	switch k {
+	case "mysql_host":
+		c.mysqlHost = v
+
+	case "mysql_port":
+		c.mysqlPort = v
+
+	case "mysql_user":
+		c.mysqlUser = v
+
+	case "mysql_password":
+		c.mysqlPassword = v
+
+	case "mysql_database":
+		c.mysqlDatabase = v
+
+	case "mysql_socket":
+		c.mysqlSocket = v
+
+	case "mysql_tls":
+		switch v {
+		case "true", "skip-verify":
+			c.tls = v
+		case "false":
+			c.tls = ""
+		default:
+			return fmt.Errorf("invalid value %q for setting `mysql_tls`", v)
+		}
+
+	case "mysql_tls_ca":
+		c.tlsCA = v
+
+	case "mysql_tls_cert":
+		c.tlsCert = v
+
+	case "mysql_tls_key":
+		c.tlsKey = v
+
+	case "mysql_compress":
+		b, err := strconv.ParseBool(v)
+		if err != nil {
+			return fmt.Errorf("invalid value %q for setting `mysql_compress`", v)
+		}
+		c.compress = b
+
+	case "interval":
+		i, err := strconv.ParseInt(v, 10, 32)
+		if err != nil || i <= 0 {
+			return fmt.Errorf("invalid value %q for setting `interval`", v)
+		}
+		c.interval = time.Duration(i) * time.Second
+
+	case "min_interval":
+		d, err := parseSeconds(v)
+		if err != nil {
+			return fmt.Errorf("invalid value %q for setting `min_interval`", v)
+		}
+		c.minInterval = d
+
+	case "lag_threshold":
+		i, err := strconv.ParseInt(v, 10, 64)
+		if err != nil || i < 0 {
+			return fmt.Errorf("invalid value %q for setting `lag_threshold`", v)
+		}
+		c.lagThreshold = i
+
+	case "delay":
+		d, err := strconv.ParseFloat(v, 32)
+		if err != nil {
+			return fmt.Errorf("invalid value %q for setting `delay`", v)
+		}
+		c.delay = d
+
+	case "timeout":
+		d, err := parseSeconds(v)
+		if err != nil {
+			return fmt.Errorf("invalid value %q for setting `timeout`", v)
+		}
+		c.timeout = d
+
+	case "connect_timeout":
+		d, err := parseSeconds(v)
+		if err != nil || d == 0 {
+			return fmt.Errorf("invalid value %q for setting `connect_timeout`", v)
+		}
+		c.connectTimeout = d
+
+	case "hostname":
+		c.hostname = v
+
+	case "tags":
+		c.tags = strings.Split(v, " ")
+
+	case "replication_query":
+		c.replicationQuery = v
+
+	case "heartbeat_table":
+		c.heartbeatTable = v
+
+	case "heartbeat_frequency":
+		d, err := parseSeconds(v)
+		if err != nil || d == 0 {
+			return fmt.Errorf("invalid value %q for setting `heartbeat_frequency`", v)
+		}
+		c.heartbeatFrequency = d
+
+	case "lag_sample_interval":
+		d, err := parseSeconds(v)
+		if err != nil {
+			return fmt.Errorf("invalid value %q for setting `lag_sample_interval`", v)
+		}
+		c.lagSampleInterval = d
+
+	case "collectors":
+		c.collectors = strings.Fields(v)
+
+	default:
+		return errUnknownSetting
+	}
+
+	return nil
+}
+
+// loadConfig parses an INI-like configuration file: a global section of
+// `key = value` lines, optionally followed by `[target <name>]` sections
+// overriding the global settings for a given server, and
+// `[collector <name>]` sections holding collector settings. A file
+// without target sections nor target discovery describes a single target
+// from its global settings, as in the original flat format.
+func loadConfig(path string) (*config, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	cfg := defaultConfig()
+	cfg.targets = nil
+
+	var (
+		defaults  = cfg.defaults
+		target    *targetConfig
+		collector map[string]string
+		lineno    int
+	)
+
+	scanner := bufio.NewScanner(f)
+	for scanner.Scan() {
+		lineno++
+		line := strings.TrimSpace(scanner.Text())
+		if len(line) == 0 || strings.HasPrefix(line, "#") {
+			continue
+		}
+
+		if strings.HasPrefix(line, "[") {
+			if !strings.HasSuffix(line, "]") {
+				return nil, fmt.Errorf("line %d: malformated section header %q", lineno, line)
+			}
+
+			kind, name := splitSection(line[1 : len(line)-1])
+			switch kind {
+			case "target":
+				if name == "" {
+					return nil, fmt.Errorf("line %d: missing target name", lineno)
+				}
+				for _, t := range cfg.targets {
+					if t.name == name {
+						return nil, fmt.Errorf("line %d: duplicate target %q", lineno, name)
+					}
+				}
+				target, collector = defaults.clone(), nil
+				target.name = name
+				cfg.targets = append(cfg.targets, target)
+
+			case "collector":
+				if _, ok := availableCollectors[name]; !ok {
+					return nil, fmt.Errorf("line %d: unknown collector %q", lineno, name)
+				}
+				if collector = cfg.collectorSettings[name]; collector == nil {
+					collector = make(map[string]string)
+					cfg.collectorSettings[name] = collector
+				}
+				target = nil
+
+			default:
+				return nil, fmt.Errorf("line %d: unknown section %q", lineno, line)
+			}
+			continue
+		}
+
+		items := strings.SplitN(line, "=", 2)
+		if len(items) != 2 {
+			return nil, fmt.Errorf("line %d: malformated line %q", lineno, line)
+		}
+
+		k, v := strings.TrimSpace(items[0]), strings.TrimSpace(items[1])
+		log.Debug("parsed configuration line",
+			"key", k,
+			"value", v)
+
+		switch {
+		case collector != nil:
+			collector[k] = v
+
+		case target != nil:
+			if err := target.set(k, v); err == errUnknownSetting {
+				return nil, fmt.Errorf("line %d: unsupported target setting %q", lineno, k)
+			} else if err != nil {
+				return nil, fmt.Errorf("line %d: %s", lineno, err)
+			}
+
+		case k == "riemann_host":
+			cfg.riemannHost = v
+
+		case k == "riemann_port":
+			cfg.riemannPort = v
+
+		case k == "graphite_host":
+			cfg.graphiteHost = v
+
+		case k == "graphite_port":
+			cfg.graphitePort = v
+
+		case k == "statsd_host":
+			cfg.statsdHost = v
+
+		case k == "statsd_port":
+			cfg.statsdPort = v
+
+		case k == "metrics_listen":
+			cfg.metricsListen = v
+
+		case k == "dial_concurrency":
+			n, err := strconv.Atoi(v)
+			if err != nil || n < 1 {
+				return nil, fmt.Errorf("line %d: invalid value %q for setting `dial_concurrency`", lineno, v)
+			}
+			cfg.dialConcurrency = n
+
+		case k == "target_dir":
+			cfg.targetDir = v
+
+		case k == "target_sockets":
+			cfg.targetSockets = v
+
+		default:
+			if err := defaults.set(k, v); err == errUnknownSetting {
+				log.Warn(fmt.Sprintf("unsupported configuration setting %q", k))
+			} else if err != nil {
+				return nil, fmt.Errorf("line %d: %s", lineno, err)
+			}
+		}
+	}
+	if err := scanner.Err(); err != nil {
+		return nil, err
+	}
+
+	if len(cfg.targets) == 0 && cfg.targetDir == "" && cfg.targetSockets == "" {
+		cfg.targets = []*targetConfig{defaults}
+	}
+
+	if err := cfg.validate(); err != nil {
+		return nil, err
+	}
+
+	return cfg, nil
+}
+
+// validate checks settings which depend on each other.
+func (cfg *config) validate() error {
+	hostnames := make(map[string]string)
+
+	// Check sections of collectors no target enables as well.
+	for name, settings := range cfg.collectorSettings {
+		if _, err := availableCollectors[name](settings, log); err != nil {
+			return fmt.Errorf("collector %q: %s", name, err)
+		}
+	}
+
+	for _, t := range cfg.targets {
+		if t.mysqlHost == "" && t.mysqlSocket == "" {
+			return fmt.Errorf("target %q: one of `mysql_host` and `mysql_socket` is required", t.name)
+		}
+
+		if _, err := newCollectors(t.collectors, cfg.collectorSettings, log); err != nil {
+			return fmt.Errorf("target %q: %s", t.name, err)
+		}
+
+		if _, err := t.tlsConfig(); err != nil {
+			return fmt.Errorf("target %q: invalid TLS settings: %s", t.name, err)
+		}
+
+		// Riemann indexes events by host and service, targets
+		// sharing a hostname would overwrite each other's events.
+		if len(cfg.targets) > 1 {
+			if other, ok := hostnames[t.hostname]; ok {
+				return fmt.Errorf("targets %q and %q must have distinct `hostname` settings", other, t.name)
+			}
+			hostnames[t.hostname] = t.name
+		}
+	}
+
+	return nil
+}
+
+func (c *targetConfig) clone() *targetConfig {
+	clone := *c
+	clone.tags = append([]string(nil), c.tags...)
+	clone.collectors = append([]string(nil), c.collectors...)
+	return &clone
+}
+
+func splitSection(s string) (string, string) {
+	fields := strings.Fields(s)
+	switch len(fields) {
+	case 0:
+		return "", ""
+	case 1:
+		return fields[0], ""
+	default:
+		return fields[0], strings.Join(fields[1:], " ")
+	}
+}
+
+// parseSeconds parses a possibly fractional, positive number of seconds.
+func parseSeconds(v string) (time.Duration, error) {
+	f, err := strconv.ParseFloat(v, 64)
+	if err != nil {
+		return 0, err
+	}
+	if f < 0 {
+		return 0, fmt.Errorf("negative duration %q", v)
+	}
+
+	return time.Duration(f * float64(time.Second)), nil
+}
+
+// settingsOf returns the settings of the collectors enabled on c.
+func (cfg *config) settingsOf(c *targetConfig) map[string]collectorSettings {
+	settings := make(map[string]collectorSettings)
+	for _, name := range c.collectors {
+		if s, ok := cfg.collectorSettings[name]; ok {
+			settings[name] = s
+		}
+	}
+	return settings
+}
+
+// sameConnection reports whether c and o only differ by settings which a
+// running target can be retuned with.
+func (c *targetConfig) sameConnection(o *targetConfig) bool {
+	return c.mysqlHost == o.mysqlHost &&
+		c.mysqlPort == o.mysqlPort &&
+		c.mysqlUser == o.mysqlUser &&
+		c.mysqlPassword == o.mysqlPassword &&
+		c.mysqlDatabase == o.mysqlDatabase &&
+		c.mysqlSocket == o.mysqlSocket &&
+		c.tls == o.tls &&
+		c.tlsCA == o.tlsCA &&
+		c.tlsCert == o.tlsCert &&
+		c.tlsKey == o.tlsKey &&
+		c.compress == o.compress &&
+		c.timeout == o.timeout &&
+		c.connectTimeout == o.connectTimeout &&
+		c.replicationQuery == o.replicationQuery &&
+		c.heartbeatTable == o.heartbeatTable &&
+		c.heartbeatFrequency == o.heartbeatFrequency &&
+		c.lagSampleInterval == o.lagSampleInterval
+}
+
+func (c *targetConfig) equal(o *targetConfig) bool {
+	return c.sameConnection(o) &&
+		c.hostname == o.hostname &&
+		strings.Join(c.tags, " ") == strings.Join(o.tags, " ") &&
+		c.interval == o.interval &&
+		c.minInterval == o.minInterval &&
+		c.lagThreshold == o.lagThreshold &&
+		c.delay == o.delay &&
+		strings.Join(c.collectors, " ") == strings.Join(o.collectors, " ")
+}
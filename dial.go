@@ -0,0 +1,153 @@
+package main
+
+import (
+	"context"
+	"math/rand"
+	"net"
+	"sync"
+	"time"
+)
+
+// dialLimiter bounds the number of connections being dialed and
+// authenticated at once across all targets, so that targets recovering
+// from a network partition do not all hit the network and the servers
+// at the same time.
+type dialLimiter struct {
+	sync.Mutex
+	slots chan struct{}
+}
+
+var dials = newDialLimiter(defaultDialConcurrency)
+
+const defaultDialConcurrency = 8
+
+func newDialLimiter(n int) *dialLimiter {
+	return &dialLimiter{slots: make(chan struct{}, n)}
+}
+
+// resize changes the number of concurrent dials. Dials in progress
+// release their slot to the previous pool.
+func (l *dialLimiter) resize(n int) {
+	l.Lock()
+	defer l.Unlock()
+
+	if cap(l.slots) != n {
+		l.slots = make(chan struct{}, n)
+	}
+}
+
+// acquire waits for a dial slot, it returns the function releasing the
+// slot, or false when dying is closed first.
+func (l *dialLimiter) acquire(dying <-chan struct{}) (func(), bool) {
+	l.Lock()
+	slots := l.slots
+	l.Unlock()
+
+	select {
+	case slots <- struct{}{}:
+		return func() { <-slots }, true
+	case <-dying:
+		return nil, false
+	}
+}
+
+// backoff computes reconnection delays with decorrelated jitter: each
+// delay is drawn between base and three times the previous one, capped.
+// Targets failing together thus spread their retries out instead of
+// reconnecting in lockstep.
+type backoff struct {
+	base, cap time.Duration
+
+	last time.Duration
+	rand *rand.Rand
+}
+
+func newBackoff(base, cap time.Duration) *backoff {
+	if base > cap {
+		base = cap
+	}
+
+	return &backoff{
+		base: base,
+		cap:  cap,
+		rand: rand.New(rand.NewSource(time.Now().UnixNano())),
+	}
+}
+
+func (b *backoff) next() time.Duration {
+	if b.last < b.base {
+		b.last = b.base
+	}
+
+	d := b.base + time.Duration(b.rand.Int63n(int64(3*b.last-b.base)+1))
+	if d > b.cap {
+		d = b.cap
+	}
+
+	b.last = d
+	return d
+}
+
+func (b *backoff) reset() {
+	b.last = 0
+}
+
+type dialFunc func(ctx context.Context, network, addr string) (net.Conn, error)
+
+// connSet tracks the open connections of a target, so that stopping the
+// target closes them and unblocks queries waiting on a server which does
+// not answer, when no timeout bounds them.
+type connSet struct {
+	sync.Mutex
+	conns  map[net.Conn]struct{}
+	closed bool
+}
+
+// dialer wraps dial so that the connections it returns are tracked until
+// they are closed.
+func (s *connSet) dialer(dial dialFunc) dialFunc {
+	return func(ctx context.Context, network, addr string) (net.Conn, error) {
+		conn, err := dial(ctx, network, addr)
+		if err != nil {
+			return nil, err
+		}
+
+		c := &trackedConn{Conn: conn, set: s}
+		s.Lock()
+		defer s.Unlock()
+		if s.closed {
+			conn.Close()
+			return nil, errTargetStopped
+		}
+		if s.conns == nil {
+			s.conns = make(map[net.Conn]struct{})
+		}
+		s.conns[c] = struct{}{}
+		return c, nil
+	}
+}
+
+// closeAll closes the tracked connections, and the ones dialed from then
+// on.
+func (s *connSet) closeAll() {
+	s.Lock()
+	defer s.Unlock()
+
+	s.closed = true
+	for c := range s.conns {
+		c.(*trackedConn).Conn.Close()
+		delete(s.conns, c)
+	}
+}
+
+type trackedConn struct {
+	net.Conn
+	set *connSet
+}
+
+func (c *trackedConn) Close() error {
+	c.set.Lock()
+	delete(c.set.conns, c)
+	c.set.Unlock()
+	return c.Conn.Close()
+}
@@ -0,0 +1,251 @@
+package main
+
+import (
+	"container/heap"
+	"fmt"
+	"strconv"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	"gopkg.in/inconshreveable/log15.v2"
+)
+
+const digestQuery = "SELECT SCHEMA_NAME, DIGEST, COUNT_STAR, SUM_TIMER_WAIT, SUM_ROWS_EXAMINED " +
+	"FROM performance_schema.events_statements_summary_by_digest WHERE DIGEST IS NOT NULL"
+
+// digestKey identifies a digest row without holding on to its strings:
+// the digest is stored decoded (MD5 or SHA-256) and the schema is hashed.
+type digestKey struct {
+	digest [32]byte
+	schema uint64
+}
+
+type digestCounters struct {
+	calls        uint64
+	timerWait    uint64
+	rowsExamined uint64
+	poll         uint64
+}
+
+// digestDelta is a candidate for the top-N. Rows are streamed, so the
+// schema and digest of candidates are copied into buffers owned by their
+// heap slot.
+type digestDelta struct {
+	schema       []byte
+	digest       []byte
+	calls        uint64
+	timerWait    uint64
+	rowsExamined uint64
+	rank         uint64
+}
+
+// digestHeap is a min-heap on rank, bounded to the top setting entries, so that
+// its root is the entry to evict when a larger one comes in.
+type digestHeap []digestDelta
+
+func (h digestHeap) Len() int            { return len(h) }
+func (h digestHeap) Less(i, j int) bool  { return h[i].rank < h[j].rank }
+func (h digestHeap) Swap(i, j int)       { h[i], h[j] = h[j], h[i] }
+func (h *digestHeap) Push(x interface{}) { *h = append(*h, x.(digestDelta)) }
+func (h *digestHeap) Pop() interface{} {
+	old := *h
+	x := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return x
+}
+
+type digestCollector struct {
+	log   log15.Logger
+	top   int
+	order string
+
+	counters map[digestKey]digestCounters
+	heap     digestHeap
+	poll     uint64
+	first    bool
+}
+
+func newDigestCollector(settings collectorSettings, logger log15.Logger) (collector, error) {
+	c := &digestCollector{
+		log:      logger,
+		top:      10,
+		order:    "latency",
+		counters: make(map[digestKey]digestCounters),
+	}
+
+	for k, v := range settings {
+		switch k {
+		case "top":
+			n, err := strconv.Atoi(v)
+			if err != nil || n < 1 {
+				return nil, fmt.Errorf("invalid value %q for setting `top`", v)
+			}
+			c.top = n
+
+		case "order":
+			if v != "latency" && v != "rows_examined" {
+				return nil, fmt.Errorf("invalid value %q for setting `order`", v)
+			}
+			c.order = v
+
+		default:
+			return nil, fmt.Errorf("unsupported setting %q", k)
+		}
+	}
+
+	return c, nil
+}
+
+func (c *digestCollector) name() string {
+	return "digest"
+}
+
+func (c *digestCollector) collect(db *mysql.Conn, t time.Time) ([]*raidman.Event, error) {
+	c.poll++
+	c.heap = c.heap[:0]
+	c.first = len(c.counters) == 0
+
+	if _, err := db.ExecuteStreaming(digestQuery, c.row); err != nil {
+		return nil, err
+	}
+
+	for key, counters := range c.counters {
+		if counters.poll != c.poll {
+			delete(c.counters, key)
+		}
+	}
+
+	events := make([]*raidman.Event, 0, len(c.heap))
+	for _, d := range c.heap {
+		schema, digest := string(d.schema), string(d.digest)
+		latency := float64(d.timerWait) / 1e12
+
+		// A digest runs in each schema separately, statements without a
+		// default schema are reported under -.
+		service := "mysql/digest/-/" + digest
+		if schema != "" {
+			service = "mysql/digest/" + schema + "/" + digest
+		}
+
+		event := newMetricEvent(t, service, latency)
+		if c.order == "rows_examined" {
+			event.Metric = int64(d.rowsExamined)
+		}
+		event.Description = fmt.Sprintf("schema: %s, calls: %d, latency: %.6fs, rows examined: %d",
+			schema, d.calls, latency, d.rowsExamined)
+		event.Attributes = map[string]string{
+			"schema":        schema,
+			"digest":        digest,
+			"calls":         strconv.FormatUint(d.calls, 10),
+			"latency":       strconv.FormatFloat(latency, 'f', 6, 64),
+			"rows_examined": strconv.FormatUint(d.rowsExamined, 10),
+		}
+		events = append(events, event)
+	}
+
+	c.log.Debug("gathered digests", "digests", len(c.counters), "top", len(events))
+
+	return events, nil
+}
+
+// row updates the counters of a digest row and offers its delta to the
+// top-N heap.
+func (c *digestCollector) row(row []interface{}) error {
+	var key digestKey
+
+	digest, ok := row[1].([]byte)
+	if !ok || !decodeDigest(digest, &key.digest) {
+		return nil
+	}
+
+	schema, _ := row[0].([]byte)
+	key.schema = fnv64a(schema)
+
+	var counters [3]uint64
+	for i := range counters {
+		switch v := row[2+i].(type) {
+		case uint64:
+			counters[i] = v
+		case int64:
+			counters[i] = uint64(v)
+		case nil:
+		default:
+			return fmt.Errorf("unexpected digest counter type %T", v)
+		}
+	}
+	calls, timerWait, rowsExamined := counters[0], counters[1], counters[2]
+
+	prev := c.counters[key]
+	if calls < prev.calls {
+		// The summary table was truncated since the last poll.
+		prev = digestCounters{}
+	}
+	c.counters[key] = digestCounters{calls, timerWait, rowsExamined, c.poll}
+
+	if c.first || calls == prev.calls {
+		return nil
+	}
+
+	rank := timerWait - prev.timerWait
+	if c.order == "rows_examined" {
+		rank = rowsExamined - prev.rowsExamined
+	}
+
+	var slot int
+	switch {
+	case len(c.heap) < c.top:
+		// Extend within capacity, so that the slot keeps the buffers
+		// it had during previous polls.
+		if len(c.heap) < cap(c.heap) {
+			c.heap = c.heap[:len(c.heap)+1]
+		} else {
+			c.heap = append(c.heap, digestDelta{})
+		}
+		slot = len(c.heap) - 1
+	case rank > c.heap[0].rank:
+		slot = 0
+	default:
+		return nil
+	}
+
+	d := &c.heap[slot]
+	d.schema = append(d.schema[:0], schema...)
+	d.digest = append(d.digest[:0], digest...)
+	d.calls = calls - prev.calls
+	d.timerWait = timerWait - prev.timerWait
+	d.rowsExamined = rowsExamined - prev.rowsExamined
+	d.rank = rank
+	heap.Fix(&c.heap, slot)
+
+	return nil
+}
+
+// decodeDigest decodes an hexadecimal statement digest into d.
+func decodeDigest(b []byte, d *[32]byte) bool {
+	if len(b) == 0 || len(b) > 2*len(d) || len(b)%2 != 0 {
+		return false
+	}
+
+	for i := 0; i < len(b); i += 2 {
+		hi, ok1 := unhex(b[i])
+		lo, ok2 := unhex(b[i+1])
+		if !ok1 || !ok2 {
+			return false
+		}
+		d[i/2] = hi<<4 | lo
+	}
+
+	return true
+}
+
+// fnv64a is the 64-bit FNV-1a hash of b, computed without the allocation
+// of a hash.Hash64.
+func fnv64a(b []byte) uint64 {
+	h := uint64(14695981039346656037)
+	for _, c := range b {
+		h ^= uint64(c)
+		h *= 1099511628211
+	}
+	return h
+}
@@ -0,0 +1,260 @@
+package main
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+	"syscall"
+)
+
+const inotifyMask = syscall.IN_CREATE | syscall.IN_DELETE | syscall.IN_CLOSE_WRITE |
+	syscall.IN_MOVED_TO | syscall.IN_MOVED_FROM | syscall.IN_DELETE_SELF | syscall.IN_MOVE_SELF
+
+// discovery watches the sources of discovered targets: a directory of
+// drop-in target files and a glob of MySQL server sockets. Sources are
+// only scanned again when inotify reports a change in their directory,
+// so that discovery costs nothing while targets do not change.
+type discovery struct {
+	dir     string
+	sockets string
+
+	inotify *os.File
+	changes chan struct{}
+}
+
+// newDiscovery starts watching the discovery sources of cfg. It returns
+// nil when discovery is disabled.
+func newDiscovery(cfg *config) *discovery {
+	if cfg.targetDir == "" && cfg.targetSockets == "" {
+		return nil
+	}
+
+	d := &discovery{
+		dir:     cfg.targetDir,
+		sockets: cfg.targetSockets,
+		changes: make(chan struct{}, 1),
+	}
+
+	fd, err := syscall.InotifyInit1(syscall.IN_CLOEXEC | syscall.IN_NONBLOCK)
+	if err != nil {
+		log.Warn("unable to watch target discovery sources, rescanning on reload only", "error", err)
+		return d
+	}
+	// A non-blocking descriptor is handled by the runtime poller, which
+	// lets close interrupt a pending read.
+	d.inotify = os.NewFile(uintptr(fd), "inotify")
+
+	for _, dir := range d.watchedDirs() {
+		if _, err := syscall.InotifyAddWatch(fd, dir, inotifyMask); err != nil {
+			log.Warn("unable to watch target discovery directory, rescanning on reload only",
+				"path", dir, "error", err)
+		}
+	}
+
+	go d.watch()
+	return d
+}
+
+func (d *discovery) watchedDirs() []string {
+	var dirs []string
+
+	if d.dir != "" {
+		dirs = append(dirs, d.dir)
+	}
+	if d.sockets != "" {
+		if dir := filepath.Dir(d.sockets); dir != d.dir {
+			dirs = append(dirs, dir)
+		}
+	}
+
+	return dirs
+}
+
+// watch signals changes reported by inotify. Events are not decoded:
+// any of them triggers a full rescan, and pending changes are coalesced.
+func (d *discovery) watch() {
+	buf := make([]byte, 4096)
+
+	for {
+		if _, err := d.inotify.Read(buf); err != nil {
+			return
+		}
+
+		select {
+		case d.changes <- struct{}{}:
+		default:
+		}
+	}
+}
+
+// changed returns the channel on which changes of the discovery sources
+// are signalled, it is nil when discovery is disabled.
+func (d *discovery) changed() <-chan struct{} {
+	if d == nil {
+		return nil
+	}
+	return d.changes
+}
+
+func (d *discovery) close() {
+	if d != nil && d.inotify != nil {
+		d.inotify.Close()
+	}
+}
+
+// targets returns the currently discovered targets, starting from the
+// global settings of cfg.
+func (d *discovery) targets(cfg *config) []*targetConfig {
+	if d == nil {
+		return nil
+	}
+
+	var targets []*targetConfig
+
+	if d.dir != "" {
+		files, err := filepath.Glob(filepath.Join(d.dir, "*.conf"))
+		if err != nil {
+			log.Warn("unable to list target directory", "path", d.dir, "error", err)
+		}
+		for _, path := range files {
+			t, err := loadTargetFile(path, cfg.defaults)
+			if err != nil {
+				log.Warn("ignoring target file", "path", path, "error", err)
+				continue
+			}
+			targets = append(targets, t)
+		}
+	}
+
+	if d.sockets != "" {
+		sockets, err := filepath.Glob(d.sockets)
+		if err != nil {
+			log.Warn("unable to list target sockets", "pattern", d.sockets, "error", err)
+		}
+		for _, path := range sockets {
+			if fi, err := os.Stat(path); err != nil || fi.Mode()&os.ModeSocket == 0 {
+				continue
+			}
+
+			t := cfg.defaults.clone()
+			t.name = strings.TrimSuffix(filepath.Base(path), ".sock")
+			t.mysqlSocket = path
+			t.mysqlHost = ""
+			t.hostname = instanceHostname(cfg.defaults.hostname, t.name)
+			targets = append(targets, t)
+		}
+	}
+
+	sort.Slice(targets, func(i, j int) bool { return targets[i].name < targets[j].name })
+	return targets
+}
+
+// loadTargetFile parses a drop-in target file of `key = value` lines,
+// which accepts the settings of a [target <name>] section. The target is
+// named after the file.
+func loadTargetFile(path string, defaults *targetConfig) (*targetConfig, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	t := defaults.clone()
+	t.name = strings.TrimSuffix(filepath.Base(path), ".conf")
+	hostname := false
+
+	var lineno int
+	scanner := bufio.NewScanner(f)
+	for scanner.Scan() {
+		lineno++
+		line := strings.TrimSpace(scanner.Text())
+		if len(line) == 0 || strings.HasPrefix(line, "#") {
+			continue
+		}
+
+		items := strings.SplitN(line, "=", 2)
+		if len(items) != 2 {
+			return nil, fmt.Errorf("line %d: malformated line %q", lineno, line)
+		}
+
+		k, v := strings.TrimSpace(items[0]), strings.TrimSpace(items[1])
+		if err := t.set(k, v); err == errUnknownSetting {
+			return nil, fmt.Errorf("line %d: unsupported target setting %q", lineno, k)
+		} else if err != nil {
+			return nil, fmt.Errorf("line %d: %s", lineno, err)
+		}
+		hostname = hostname || k == "hostname"
+	}
+	if err := scanner.Err(); err != nil {
+		return nil, err
+	}
+
+	if t.mysqlHost == "" && t.mysqlSocket == "" {
+		return nil, errors.New("one of `mysql_host` and `mysql_socket` is required")
+	}
+
+	if !hostname {
+		t.hostname = instanceHostname(defaults.hostname, t.name)
+	}
+
+	return t, nil
+}
+
+// instanceHostname returns the event host of a discovered instance, so
+// that instances of the same host do not overwrite each other's events.
+func instanceHostname(hostname, instance string) string {
+	if hostname == "" {
+		hostname, _ = os.Hostname()
+	}
+	return hostname + ":" + instance
+}
+
+// withDiscovered returns a copy of cfg which also holds the discovered
+// targets. Discovered targets which clash with configured ones, or with
+// each other, are ignored.
+func (cfg *config) withDiscovered(discovered []*targetConfig) *config {
+	if len(discovered) == 0 {
+		return cfg
+	}
+
+	merged := *cfg
+	merged.targets = append([]*targetConfig(nil), cfg.targets...)
+
+	names := make(map[string]bool)
+	hostnames := make(map[string]bool)
+	for _, t := range cfg.targets {
+		names[t.name] = true
+		hostnames[t.hostname] = true
+	}
+
+	for _, t := range discovered {
+		switch {
+		case names[t.name]:
+			log.Warn("ignoring discovered target with a duplicate name", "target", t.name)
+			continue
+		case hostnames[t.hostname]:
+			log.Warn("ignoring discovered target with a duplicate hostname", "target", t.name,
+				"hostname", t.hostname)
+			continue
+		}
+
+		if _, err := newCollectors(t.collectors, cfg.collectorSettings, log); err != nil {
+			log.Warn("ignoring discovered target", "target", t.name, "error", err)
+			continue
+		}
+		if _, err := t.tlsConfig(); err != nil {
+			log.Warn("ignoring discovered target with invalid TLS settings", "target", t.name, "error", err)
+			continue
+		}
+
+		names[t.name] = true
+		hostnames[t.hostname] = true
+		merged.targets = append(merged.targets, t)
+	}
+
+	return &merged
+}
@@ -0,0 +1,177 @@
+package main
+
+import (
+	"net"
+	"strconv"
+	"time"
+
+	"github.com/amir/raidman"
+)
+
+// statsdPacketSize keeps StatsD datagrams within the usual Ethernet MTU.
+const statsdPacketSize = 1432
+
+// graphiteSink sends events which carry a metric to Graphite over TCP, in
+// the plaintext protocol. The connection is dialed again on the next send
+// after a failure.
+type graphiteSink struct {
+	addr string
+	conn net.Conn
+	buf  []byte
+}
+
+func newGraphiteSink(addr string) sink {
+	return &graphiteSink{addr: addr}
+}
+
+func (g *graphiteSink) name() string {
+	return "graphite"
+}
+
+func (g *graphiteSink) send(events []*raidman.Event) error {
+	var num [32]byte
+
+	g.buf = g.buf[:0]
+	for _, event := range events {
+		value, ok := appendMetricValue(num[:0], event.Metric)
+		if !ok {
+			continue
+		}
+
+		g.buf = appendMetricPath(g.buf, event)
+		g.buf = append(g.buf, ' ')
+		g.buf = append(g.buf, value...)
+		g.buf = append(g.buf, ' ')
+		g.buf = strconv.AppendInt(g.buf, event.Time, 10)
+		g.buf = append(g.buf, '\n')
+	}
+	if len(g.buf) == 0 {
+		return nil
+	}
+
+	if g.conn == nil {
+		conn, err := net.DialTimeout("tcp", g.addr, sinkTimeout)
+		if err != nil {
+			return err
+		}
+		g.conn = conn
+	}
+
+	g.conn.SetWriteDeadline(time.Now().Add(sinkTimeout))
+	if _, err := g.conn.Write(g.buf); err != nil {
+		g.close()
+		return err
+	}
+
+	return nil
+}
+
+func (g *graphiteSink) close() {
+	if g.conn != nil {
+		g.conn.Close()
+		g.conn = nil
+	}
+}
+
+// statsdSink sends events which carry a metric to StatsD as gauges, packing
+// as many of them as fit in each UDP datagram.
+type statsdSink struct {
+	addr   string
+	conn   net.Conn
+	buf    []byte
+	packet []byte
+}
+
+func newStatsdSink(addr string) sink {
+	return &statsdSink{addr: addr}
+}
+
+func (s *statsdSink) name() string {
+	return "statsd"
+}
+
+func (s *statsdSink) send(events []*raidman.Event) error {
+	if s.conn == nil {
+		conn, err := net.Dial("udp", s.addr)
+		if err != nil {
+			return err
+		}
+		s.conn = conn
+	}
+
+	var num [32]byte
+
+	s.packet = s.packet[:0]
+	for _, event := range events {
+		value, ok := appendMetricValue(num[:0], event.Metric)
+		if !ok {
+			continue
+		}
+
+		s.buf = s.buf[:0]
+		if value[0] == '-' {
+			// A signed gauge value is a delta, reset the gauge
+			// first so that it is set to the negative value.
+			s.buf = appendMetricPath(s.buf, event)
+			s.buf = append(s.buf, ":0|g\n"...)
+		}
+		s.buf = appendMetricPath(s.buf, event)
+		s.buf = append(s.buf, ':')
+		s.buf = append(s.buf, value...)
+		s.buf = append(s.buf, "|g\n"...)
+
+		if len(s.packet)+len(s.buf) > statsdPacketSize {
+			if err := s.flush(); err != nil {
+				return err
+			}
+		}
+		s.packet = append(s.packet, s.buf...)
+	}
+
+	return s.flush()
+}
+
+func (s *statsdSink) flush() error {
+	if len(s.packet) == 0 {
+		return nil
+	}
+
+	// Lines are newline terminated, drop the last one.
+	_, err := s.conn.Write(s.packet[:len(s.packet)-1])
+	s.packet = s.packet[:0]
+	if err != nil {
+		s.close()
+	}
+	return err
+}
+
+func (s *statsdSink) close() {
+	if s.conn != nil {
+		s.conn.Close()
+		s.conn = nil
+	}
+}
+
+// appendMetricPath encodes the dotted metric path of an event: its host,
+// with dots replaced, followed by its service with slashes turned into
+// dots, such as db1_example_com.mysql.replication.conn0.
+func appendMetricPath(dst []byte, event *raidman.Event) []byte {
+	dst = appendPathComponent(dst, event.Host, false)
+	dst = append(dst, '.')
+	return appendPathComponent(dst, event.Service, true)
+}
+
+func appendPathComponent(dst []byte, s string, slashes bool) []byte {
+	for i := 0; i < len(s); i++ {
+		c := s[i]
+		switch {
+		case c == '/' && slashes:
+			c = '.'
+		case 'a' <= c && c <= 'z', 'A' <= c && c <= 'Z', '0' <= c && c <= '9', c == '-', c == '_':
+		default:
+			c = '_'
+		}
+		dst = append(dst, c)
+	}
+	return dst
+}
@@ -0,0 +1,130 @@
+package main
+
+import (
+	"fmt"
+
+	"github.com/amir/raidman"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+)
+
+// gtidSetCache keeps the last parsed value of a GTID set column. When the
+// column text changed since the previous poll, only the per-UUID or
+// per-domain components whose text changed are parsed again, so large
+// multi-source sets with a single moving component are cheap to track.
+type gtidSetCache struct {
+	raw   []byte
+	valid bool
+
+	mariadb mariadbGTIDs
+	mysql   mysqlGTIDs
+}
+
+func (c *gtidSetCache) update(flavor, raw string) error {
+	if c.valid && raw == string(c.raw) {
+		return nil
+	}
+
+	var err error
+	switch flavor {
+	case gomysql.MariaDBFlavor:
+		err = c.mariadb.parse(raw)
+	case gomysql.MySQLFlavor:
+		err = c.mysql.parse(raw)
+	default:
+		err = fmt.Errorf("invalid flavor %s", flavor)
+	}
+
+	// The column text may point into a buffer which does not outlive
+	// the poll, keep a copy.
+	c.raw = append(c.raw[:0], raw...)
+	c.valid = err == nil
+	return err
+}
+
+// missing counts the transactions of c which are not in executed.
+func (c *gtidSetCache) missing(flavor string, executed *gtidSetCache) int64 {
+	if flavor == gomysql.MariaDBFlavor {
+		return c.mariadb.missing(&executed.mariadb)
+	}
+	return c.mysql.missing(&executed.mysql)
+}
+
+// gtidChannel holds the GTID set caches of a replication connection.
+type gtidChannel struct {
+	received gtidSetCache
+	executed gtidSetCache
+	poll     uint64
+}
+
+// gtidEvent builds the GTID lag event of the replication connection at
+// row i: the number of transactions received from the primary which are
+// not yet executed. It returns nil when the connection does not use GTIDs.
+func (tg *target) gtidEvent(rs *gomysql.Resultset, i int, cols *replicationColumns, repl *raidman.Event) *raidman.Event {
+	flavor := cols.gtidFlavor
+	if flavor == "" {
+		return nil
+	}
+
+	received, err := rs.ColumnString(i, cols.gtidReceived)
+	if err != nil || received == "" {
+		return nil
+	}
+
+	event := &raidman.Event{
+		Time:    repl.Time,
+		Service: repl.Service + "/gtid",
+		State:   "ok",
+	}
+
+	executed, err := rs.ColumnString(i, cols.gtidExecuted)
+	if err != nil {
+		event.State = "unknown"
+		event.Description = fmt.Sprintf("unable to retrieve executed GTID set: %s", err)
+		tg.log.Warn(event.Description)
+		return event
+	}
+
+	ch, ok := tg.gtidChannels[repl.Service]
+	if !ok {
+		ch = new(gtidChannel)
+		tg.gtidChannels[repl.Service] = ch
+	}
+	ch.poll = tg.gtidPoll
+
+	if err := ch.received.update(flavor, received); err != nil {
+		event.State = "unknown"
+		event.Description = fmt.Sprintf("unable to parse received GTID set: %s", err)
+		tg.log.Warn(event.Description)
+		return event
+	}
+
+	if err := ch.executed.update(flavor, executed); err != nil {
+		event.State = "unknown"
+		event.Description = fmt.Sprintf("unable to parse executed GTID set: %s", err)
+		tg.log.Warn(event.Description)
+		return event
+	}
+
+	missing := ch.received.missing(flavor, &ch.executed)
+
+	tg.log.Debug("gathered gtid",
+		"service", event.Service,
+		"received", received,
+		"executed", executed,
+		"missing", missing)
+
+	event.Description = fmt.Sprintf("%d transactions received but not executed", missing)
+	event.Metric = missing
+	return event
+}
+
+// pruneGTIDChannels forgets the caches of connections which were not seen
+// during the last poll, and starts a new poll.
+func (tg *target) pruneGTIDChannels() {
+	for service, ch := range tg.gtidChannels {
+		if ch.poll != tg.gtidPoll {
+			delete(tg.gtidChannels, service)
+		}
+	}
+	tg.gtidPoll++
+}
@@ -0,0 +1,426 @@
+package main
+
+import (
+	"bytes"
+	"fmt"
+)
+
+// gtidInterval is a [start, stop) range of MySQL transaction numbers.
+type gtidInterval struct {
+	start, stop int64
+}
+
+// uuidGTIDs holds the normalized intervals of a single source UUID.
+type uuidGTIDs struct {
+	sid       [16]byte
+	intervals []gtidInterval
+}
+
+// gtidPart is a component of a GTID set text along with its parsed value.
+// text is only set once the component parsed, so that a component which
+// failed to parse is parsed again.
+type gtidPart struct {
+	text []byte
+	set  uuidGTIDs
+}
+
+// mysqlGTIDs is a MySQL GTID set stored as an array sorted by source UUID,
+// each with a sorted array of non overlapping intervals. The per-UUID
+// components of the text are kept in order, and only those whose text
+// changed since the previous value are parsed again, into their previous
+// arrays, so that refreshing a set where a single UUID moved parses that
+// UUID alone and does not allocate.
+type mysqlGTIDs struct {
+	parts []gtidPart
+	// sets share the interval arrays of parts.
+	sets []uuidGTIDs
+}
+
+func (s *mysqlGTIDs) parse(raw string) error {
+	n := 0
+	for i := 0; ; {
+		var comp string
+		if comp, i = nextGTIDComponent(raw, i); comp == "" {
+			break
+		}
+
+		if n < cap(s.parts) {
+			s.parts = s.parts[:n+1]
+		} else {
+			s.parts = append(s.parts, gtidPart{})
+		}
+		p := &s.parts[n]
+		n++
+
+		if string(p.text) == comp {
+			continue
+		}
+		p.text = p.text[:0]
+		if err := p.set.parse(comp); err != nil {
+			s.parts = s.parts[:n]
+			return err
+		}
+		p.text = append(p.text, comp...)
+	}
+	s.parts = s.parts[:n]
+
+	s.sets = s.sets[:0]
+	for i := range s.parts {
+		s.sets = append(s.sets, s.parts[i].set)
+	}
+	s.normalize()
+	return nil
+}
+
+// parse parses a single UUID:interval[:interval] component.
+func (set *uuidGTIDs) parse(comp string) error {
+	set.intervals = set.intervals[:0]
+
+	i, err := parseUUID(comp, &set.sid)
+	if err != nil {
+		return err
+	}
+
+	for i < len(comp) && comp[i] == ':' {
+		i++
+
+		var (
+			in gtidInterval
+			n  int
+		)
+		if in.start, n = parseDecimal(comp[i:]); n == 0 {
+			return fmt.Errorf("invalid GTID interval in %q", comp)
+		}
+		i += n
+		in.stop = in.start + 1
+
+		if i < len(comp) && comp[i] == '-' {
+			i++
+			var stop int64
+			if stop, n = parseDecimal(comp[i:]); n == 0 {
+				return fmt.Errorf("invalid GTID interval in %q", comp)
+			}
+			i += n
+			in.stop = stop + 1
+		}
+
+		if in.stop <= in.start {
+			return fmt.Errorf("invalid GTID interval %d-%d", in.start, in.stop-1)
+		}
+		set.intervals = append(set.intervals, in)
+	}
+
+	if len(set.intervals) == 0 {
+		return fmt.Errorf("invalid GTID format, must UUID:interval[:interval]")
+	}
+	if i < len(comp) {
+		return fmt.Errorf("invalid GTID set character %q in %q", comp[i], comp)
+	}
+
+	set.intervals = normalizeIntervals(set.intervals)
+	return nil
+}
+
+// normalize sorts the set by UUID and merges repeated UUIDs, in place.
+// Servers print GTID sets already normalized, so insertion sorts only ever
+// compare.
+func (s *mysqlGTIDs) normalize() {
+	for i := 1; i < len(s.sets); i++ {
+		for j := i; j > 0 && bytes.Compare(s.sets[j-1].sid[:], s.sets[j].sid[:]) > 0; j-- {
+			s.sets[j-1], s.sets[j] = s.sets[j], s.sets[j-1]
+		}
+	}
+
+	n := 0
+	for i := range s.sets {
+		if n > 0 && s.sets[n-1].sid == s.sets[i].sid {
+			// The interval arrays belong to parts, merge into a new
+			// one. Servers never print repeated UUIDs.
+			prev := &s.sets[n-1]
+			merged := make([]gtidInterval, 0, len(prev.intervals)+len(s.sets[i].intervals))
+			merged = append(append(merged, prev.intervals...), s.sets[i].intervals...)
+			prev.intervals = normalizeIntervals(merged)
+			continue
+		}
+		s.sets[n] = s.sets[i]
+		n++
+	}
+	s.sets = s.sets[:n]
+}
+
+func normalizeIntervals(in []gtidInterval) []gtidInterval {
+	for i := 1; i < len(in); i++ {
+		for j := i; j > 0 && in[j].start < in[j-1].start; j-- {
+			in[j-1], in[j] = in[j], in[j-1]
+		}
+	}
+
+	n := 0
+	for i := range in {
+		if n > 0 && in[i].start <= in[n-1].stop {
+			if in[i].stop > in[n-1].stop {
+				in[n-1].stop = in[i].stop
+			}
+			continue
+		}
+		in[n] = in[i]
+		n++
+	}
+
+	return in[:n]
+}
+
+// missing counts the transactions of s which are not in executed.
+func (s *mysqlGTIDs) missing(executed *mysqlGTIDs) int64 {
+	var n int64
+
+	j := 0
+	for i := range s.sets {
+		for j < len(executed.sets) && bytes.Compare(executed.sets[j].sid[:], s.sets[i].sid[:]) < 0 {
+			j++
+		}
+
+		var applied []gtidInterval
+		if j < len(executed.sets) && executed.sets[j].sid == s.sets[i].sid {
+			applied = executed.sets[j].intervals
+		}
+		n += intervalsMissing(s.sets[i].intervals, applied)
+	}
+
+	return n
+}
+
+// intervalsMissing counts the transaction numbers of a which are not in b,
+// both being normalized.
+func intervalsMissing(a, b []gtidInterval) int64 {
+	var n int64
+
+	j := 0
+	for _, in := range a {
+		n += in.stop - in.start
+		for ; j < len(b) && b[j].stop <= in.start; j++ {
+		}
+		for k := j; k < len(b) && b[k].start < in.stop; k++ {
+			start, stop := b[k].start, b[k].stop
+			if start < in.start {
+				start = in.start
+			}
+			if stop > in.stop {
+				stop = in.stop
+			}
+			n -= stop - start
+		}
+	}
+
+	return n
+}
+
+// mariadbGTID is the position of a MariaDB replication domain.
+type mariadbGTID struct {
+	domain, server uint32
+	seq            uint64
+}
+
+// mariadbPart is a component of a MariaDB GTID position text along with
+// its parsed value, see gtidPart.
+type mariadbPart struct {
+	text []byte
+	gtid mariadbGTID
+}
+
+// mariadbGTIDs is a MariaDB GTID position, one entry per domain, sorted by
+// domain. Like mysqlGTIDs, only the per-domain components whose text
+// changed are parsed again.
+type mariadbGTIDs struct {
+	parts   []mariadbPart
+	domains []mariadbGTID
+}
+
+func (s *mariadbGTIDs) parse(raw string) error {
+	s.parts = s.parts[:0]
+	s.domains = s.domains[:0]
+
+	for i := 0; ; {
+		var comp string
+		if comp, i = nextGTIDComponent(raw, i); comp == "" {
+			break
+		}
+
+		n := len(s.parts)
+		if n < cap(s.parts) {
+			s.parts = s.parts[:n+1]
+		} else {
+			s.parts = append(s.parts, mariadbPart{})
+		}
+		p := &s.parts[n]
+
+		if string(p.text) != comp {
+			p.text = p.text[:0]
+			if err := p.gtid.parse(comp); err != nil {
+				return err
+			}
+			p.text = append(p.text, comp...)
+		}
+
+		s.set(p.gtid)
+	}
+
+	return nil
+}
+
+// parse parses a single domain-server-sequence component.
+func (gtid *mariadbGTID) parse(comp string) error {
+	var (
+		v int64
+		n int
+	)
+
+	i := 0
+	for field := 0; field < 3; field++ {
+		if field > 0 {
+			if i == len(comp) || comp[i] != '-' {
+				return fmt.Errorf("invalid MariaDB GTID, must domain-server-sequence")
+			}
+			i++
+		}
+
+		if v, n = parseDecimal(comp[i:]); n == 0 {
+			return fmt.Errorf("invalid MariaDB GTID %q", comp)
+		}
+		i += n
+
+		switch field {
+		case 0:
+			gtid.domain = uint32(v)
+		case 1:
+			gtid.server = uint32(v)
+		case 2:
+			gtid.seq = uint64(v)
+		}
+	}
+
+	if i < len(comp) {
+		return fmt.Errorf("invalid GTID position character %q in %q", comp[i], comp)
+	}
+
+	return nil
+}
+
+// set inserts gtid at its sorted position, replacing the previous position
+// of its domain.
+func (s *mariadbGTIDs) set(gtid mariadbGTID) {
+	j := len(s.domains)
+	for j > 0 && s.domains[j-1].domain > gtid.domain {
+		j--
+	}
+
+	if j > 0 && s.domains[j-1].domain == gtid.domain {
+		s.domains[j-1] = gtid
+		return
+	}
+
+	s.domains = append(s.domains, mariadbGTID{})
+	copy(s.domains[j+1:], s.domains[j:])
+	s.domains[j] = gtid
+}
+
+// missing counts the transactions of s which are not in executed.
+func (s *mariadbGTIDs) missing(executed *mariadbGTIDs) int64 {
+	var n int64
+
+	j := 0
+	for _, gtid := range s.domains {
+		for j < len(executed.domains) && executed.domains[j].domain < gtid.domain {
+			j++
+		}
+
+		var applied uint64
+		if j < len(executed.domains) && executed.domains[j].domain == gtid.domain {
+			applied = executed.domains[j].seq
+		}
+		if gtid.seq > applied {
+			n += int64(gtid.seq - applied)
+		}
+	}
+
+	return n
+}
+
+// nextGTIDComponent returns the comma separated component of a GTID set
+// text which starts at or after i, without surrounding spaces, along with
+// the offset following it. The component is empty at the end of the text.
+func nextGTIDComponent(raw string, i int) (string, int) {
+	for i < len(raw) && (raw[i] == ',' || isSpace(raw[i])) {
+		i++
+	}
+
+	start := i
+	for i < len(raw) && raw[i] != ',' {
+		i++
+	}
+
+	end := i
+	for end > start && isSpace(raw[end-1]) {
+		end--
+	}
+
+	return raw[start:end], i
+}
+
+// parseUUID decodes the canonical 36 characters textual form of a UUID.
+func parseUUID(s string, sid *[16]byte) (int, error) {
+	if len(s) < 36 {
+		return 0, fmt.Errorf("invalid GTID source UUID %q", s)
+	}
+
+	j := 0
+	for i := 0; i < 36; {
+		if i == 8 || i == 13 || i == 18 || i == 23 {
+			if s[i] != '-' {
+				return 0, fmt.Errorf("invalid GTID source UUID %q", s[:36])
+			}
+			i++
+			continue
+		}
+
+		hi, ok1 := unhex(s[i])
+		lo, ok2 := unhex(s[i+1])
+		if !ok1 || !ok2 {
+			return 0, fmt.Errorf("invalid GTID source UUID %q", s[:36])
+		}
+		sid[j] = hi<<4 | lo
+		j++
+		i += 2
+	}
+
+	return 36, nil
+}
+
+func unhex(c byte) (byte, bool) {
+	switch {
+	case '0' <= c && c <= '9':
+		return c - '0', true
+	case 'a' <= c && c <= 'f':
+		return c - 'a' + 10, true
+	case 'A' <= c && c <= 'F':
+		return c - 'A' + 10, true
+	}
+	return 0, false
+}
+
+// parseDecimal parses the leading unsigned decimal number of s, returning
+// it along with the number of bytes consumed, 0 if there is none.
+func parseDecimal(s string) (int64, int) {
+	var v int64
+
+	i := 0
+	for ; i < len(s) && i < 19 && '0' <= s[i] && s[i] <= '9'; i++ {
+		v = v*10 + int64(s[i]-'0')
+	}
+
+	return v, i
+}
+
+func isSpace(c byte) bool {
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r'
+}
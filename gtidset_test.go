@@ -0,0 +1,110 @@
+package main
+
+import (
+	"fmt"
+	"strings"
+	"testing"
+
+	gomysql "github.com/siddontang/go-mysql/mysql"
+)
+
+// benchmarkSources is the number of source UUIDs of benchmark GTID sets,
+// as found on multi-source replicas.
+const benchmarkSources = 32
+
+// benchmarkGTIDSets returns count MySQL GTID set texts in which a single
+// source UUID moves forward from one text to the next, as between polls.
+func benchmarkGTIDSets(count int) []string {
+	texts := make([]string, count)
+	for k := range texts {
+		parts := make([]string, benchmarkSources)
+		for i := range parts {
+			stop := 1000000 + i*1000
+			if i == 0 {
+				stop += k
+			}
+			parts[i] = fmt.Sprintf("%08x-0000-4000-8000-%012x:1-%d:%d-%d", i, i, stop/2, stop/2+2, stop)
+		}
+		texts[k] = strings.Join(parts, ",\n")
+	}
+	return texts
+}
+
+func BenchmarkGTIDSetParse(b *testing.B) {
+	texts := benchmarkGTIDSets(64)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		var s mysqlGTIDs
+		if err := s.parse(texts[i%len(texts)]); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkGTIDSetUpdate(b *testing.B) {
+	texts := benchmarkGTIDSets(64)
+
+	var c gtidSetCache
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := c.update(gomysql.MySQLFlavor, texts[i%len(texts)]); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkGTIDSetMissing(b *testing.B) {
+	texts := benchmarkGTIDSets(2)
+
+	var received, executed gtidSetCache
+	if err := received.update(gomysql.MySQLFlavor, texts[1]); err != nil {
+		b.Fatal(err)
+	}
+	if err := executed.update(gomysql.MySQLFlavor, texts[0]); err != nil {
+		b.Fatal(err)
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if n := received.missing(gomysql.MySQLFlavor, &executed); n != 1 {
+			b.Fatalf("%d missing transactions, want 1", n)
+		}
+	}
+}
+
+func BenchmarkGomysqlGTIDSetParse(b *testing.B) {
+	texts := benchmarkGTIDSets(64)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := gomysql.ParseMysqlGTIDSet(texts[i%len(texts)]); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkGomysqlGTIDSetContain(b *testing.B) {
+	texts := benchmarkGTIDSets(2)
+
+	received, err := gomysql.ParseMysqlGTIDSet(texts[1])
+	if err != nil {
+		b.Fatal(err)
+	}
+	executed, err := gomysql.ParseMysqlGTIDSet(texts[0])
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if executed.Contain(received) {
+			b.Fatal("executed set contains the received one")
+		}
+	}
+}
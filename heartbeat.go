@@ -0,0 +1,173 @@
+package main
+
+import (
+	"fmt"
+	"sync/atomic"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+	"gopkg.in/tomb.v2"
+)
+
+// heartbeatTimeFormat matches the timestamp format written by pt-heartbeat,
+// so that an existing heartbeat table can be shared with it.
+const heartbeatTimeFormat = "2006-01-02T15:04:05.000000"
+
+func (tg *target) setPrimary(primary bool) {
+	var v int32
+	if primary {
+		v = 1
+	}
+	atomic.StoreInt32(&tg.primary, v)
+}
+
+// heartbeatLoop writes a high-resolution timestamp row into the heartbeat
+// table every heartbeat_frequency, as long as the server is a primary.
+// It uses a dedicated connection so that writes are not delayed by the
+// polling loop.
+func (tg *target) heartbeatLoop(t *tomb.Tomb) error {
+	var (
+		db       *mysql.Conn
+		serverID int64
+		err      error
+		retryAt  time.Time
+	)
+
+	reset := func() {
+		if db != nil {
+			db.Close()
+		}
+		db, serverID = nil, 0
+	}
+
+	retry := newBackoff(reconnectBackoff, maxReconnectBackoff)
+	tick := time.NewTicker(tg.heartbeatFrequency)
+	defer tick.Stop()
+
+	for {
+		select {
+		case now := <-tick.C:
+			if atomic.LoadInt32(&tg.primary) == 0 || now.Before(retryAt) {
+				continue
+			}
+
+			if db, err = tg.getDbHandle(db); err != nil {
+				serverID = 0
+				delay := retry.next()
+				retryAt = now.Add(delay)
+				tg.log.Warn("unable to get heartbeat database handle", "error", err, "retry", delay)
+				continue
+			}
+			retry.reset()
+
+			if serverID == 0 {
+				if serverID, err = readServerID(db); err != nil {
+					tg.log.Warn("unable to read heartbeat server id", "error", err)
+					reset()
+					continue
+				}
+			}
+
+			if err = tg.writeHeartbeat(db, serverID, time.Now()); err != nil {
+				tg.log.Warn("unable to write heartbeat", "error", err)
+				reset()
+			}
+
+		case <-t.Dying():
+			reset()
+			return nil
+		}
+	}
+}
+
+// readServerID returns the server id of the server db is connected to.
+func readServerID(db *mysql.Conn) (int64, error) {
+	r, err := db.Execute("SELECT @@server_id")
+	if err != nil {
+		return 0, err
+	}
+	return r.Resultset.GetInt(0, 0)
+}
+
+// writeHeartbeat writes the heartbeat row of the primary serverID. The
+// server id is a literal rather than @@server_id, which replicas would
+// evaluate to their own id when applying the statement under
+// statement-based replication.
+func (tg *target) writeHeartbeat(db *mysql.Conn, serverID int64, now time.Time) error {
+	_, err := db.Execute(fmt.Sprintf("REPLACE INTO %s (server_id, ts) VALUES (%d, '%s')",
+		tg.heartbeatTable, serverID, now.UTC().Format(heartbeatTimeFormat)))
+	return err
+}
+
+// readHeartbeat returns the replication lag in seconds, with microsecond
+// precision, of the heartbeat row written by the primary masterID.
+func (tg *target) readHeartbeat(db *mysql.Conn, masterID int64, now time.Time) (float64, error) {
+	r, err := db.Execute(fmt.Sprintf("SELECT ts FROM %s WHERE server_id = %d", tg.heartbeatTable, masterID))
+	if err != nil {
+		return 0, err
+	}
+
+	if r.Resultset.RowNumber() == 0 {
+		return 0, fmt.Errorf("no heartbeat row for server_id %d", masterID)
+	}
+
+	v, err := r.Resultset.GetString(0, 0)
+	if err != nil {
+		return 0, err
+	}
+
+	return heartbeatLag(v, now)
+}
+
+// heartbeatEvent builds the heartbeat lag event of the replication
+// connection at row i, alongside its replication event.
+func (tg *target) heartbeatEvent(db *mysql.Conn, rs *gomysql.Resultset, i int, cols *replicationColumns,
+	repl *raidman.Event, now time.Time) *raidman.Event {
+	event := &raidman.Event{
+		Time:    repl.Time,
+		Service: repl.Service + "/heartbeat",
+		State:   "ok",
+	}
+
+	masterID, err := rs.ColumnInt64(i, cols.masterServerID)
+	if err != nil {
+		event.State = "unknown"
+		event.Description = fmt.Sprintf("unable to retrieve master server id: %s", err)
+		tg.log.Warn(event.Description)
+		return event
+	}
+
+	lag, err := tg.readHeartbeat(db, masterID, now)
+	if err != nil {
+		event.State = "unknown"
+		event.Description = fmt.Sprintf("unable to read heartbeat: %s", err)
+		tg.log.Warn(event.Description)
+		return event
+	}
+
+	tg.log.Debug("gathered heartbeat",
+		"service", event.Service,
+		"master_id", masterID,
+		"lag", lag)
+
+	event.Description = fmt.Sprintf("heartbeat lag: %.6fs", lag)
+	event.Metric = lag
+	return event
+}
+
+func heartbeatLag(v string, now time.Time) (float64, error) {
+	ts, err := time.Parse(heartbeatTimeFormat, v)
+	if err != nil {
+		return 0, fmt.Errorf("invalid heartbeat timestamp %q", v)
+	}
+
+	lag := now.Sub(ts).Seconds()
+	if lag < 0 {
+		// Clock skew between the primary and this host.
+		lag = 0
+	}
+
+	return lag, nil
+}
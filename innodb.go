@@ -0,0 +1,191 @@
+package main
+
+import (
+	"bytes"
+	"fmt"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+	"gopkg.in/inconshreveable/log15.v2"
+)
+
+var (
+	innodbHistoryListLength = []byte("History list length")
+	innodbLogSequenceNumber = []byte("Log sequence number")
+	innodbLastCheckpoint    = []byte("Last checkpoint at")
+	innodbPendingReads      = []byte("Pending reads")
+	innodbPendingWrites     = []byte("Pending writes:")
+	innodbPendingFlushes    = []byte("Pending flushes (fsync)")
+	innodbSemaphoreWait     = []byte("--Thread ")
+)
+
+const (
+	innodbSeenHistoryListLength = 1 << iota
+	innodbSeenLogSequenceNumber
+	innodbSeenLastCheckpoint
+	innodbSeenPendingReads
+	innodbSeenPendingWrites
+	innodbSeenPendingFlushes
+)
+
+// innodbStatus holds the values extracted from the output of
+// SHOW ENGINE INNODB STATUS.
+type innodbStatus struct {
+	historyListLength uint64
+	logSequenceNumber uint64
+	lastCheckpoint    uint64
+	pendingReads      uint64
+	pendingWrites     uint64
+	pendingFsyncs     uint64
+	semaphoreWaits    uint64
+
+	seen uint
+}
+
+// parse scans the status text line by line, in a single pass and without
+// allocating. Only the first occurrence of a value is kept, since the
+// per-instance buffer pool sections repeat the global pending counters.
+func (s *innodbStatus) parse(b []byte) {
+	*s = innodbStatus{}
+
+	for len(b) > 0 {
+		line := b
+		if i := bytes.IndexByte(b, '\n'); i >= 0 {
+			line, b = b[:i], b[i+1:]
+		} else {
+			b = nil
+		}
+
+		if len(line) < 9 {
+			continue
+		}
+
+		switch line[0] {
+		case 'H':
+			s.scanFirst(line, innodbHistoryListLength, innodbSeenHistoryListLength, &s.historyListLength)
+		case 'L':
+			s.scanFirst(line, innodbLogSequenceNumber, innodbSeenLogSequenceNumber, &s.logSequenceNumber)
+			s.scanFirst(line, innodbLastCheckpoint, innodbSeenLastCheckpoint, &s.lastCheckpoint)
+		case 'P':
+			s.scanFirst(line, innodbPendingReads, innodbSeenPendingReads, &s.pendingReads)
+			s.scanFirst(line, innodbPendingWrites, innodbSeenPendingWrites, &s.pendingWrites)
+			s.scanFirst(line, innodbPendingFlushes, innodbSeenPendingFlushes, &s.pendingFsyncs)
+		case '-':
+			if bytes.HasPrefix(line, innodbSemaphoreWait) {
+				s.semaphoreWaits++
+			}
+		}
+	}
+}
+
+// scanFirst stores into v the sum of the numbers following prefix on line,
+// if line starts with prefix and no value was already seen for flag.
+func (s *innodbStatus) scanFirst(line, prefix []byte, flag uint, v *uint64) {
+	if s.seen&flag == 0 && bytes.HasPrefix(line, prefix) {
+		*v = sumNumbers(line[len(prefix):])
+		s.seen |= flag
+	}
+}
+
+// sumNumbers adds up all the unsigned decimal numbers found in b, such as
+// the LRU, flush list and single page counts of "Pending writes:".
+func sumNumbers(b []byte) uint64 {
+	var sum, v uint64
+	var inNumber bool
+
+	for _, c := range b {
+		if '0' <= c && c <= '9' {
+			v = v*10 + uint64(c-'0')
+			inNumber = true
+			continue
+		}
+		if inNumber {
+			sum += v
+			v, inNumber = 0, false
+		}
+	}
+
+	return sum + v
+}
+
+var innodbQueries = []string{"SHOW ENGINE INNODB STATUS"}
+
+type innodbCollector struct {
+	log    log15.Logger
+	status innodbStatus
+}
+
+func newInnodbCollector(settings collectorSettings, logger log15.Logger) (collector, error) {
+	return &innodbCollector{log: logger}, noSettings(settings)
+}
+
+func (c *innodbCollector) name() string {
+	return "innodb"
+}
+
+func (c *innodbCollector) queries() []string {
+	return innodbQueries
+}
+
+func (c *innodbCollector) collect(db *mysql.Conn, t time.Time) ([]*raidman.Event, error) {
+	results, err := executeAll(db, innodbQueries)
+	if err != nil {
+		return nil, err
+	}
+	return c.process(results, t)
+}
+
+func (c *innodbCollector) process(results []*gomysql.Result, t time.Time) ([]*raidman.Event, error) {
+	r := results[0]
+
+	if r.Resultset.RowNumber() == 0 {
+		return nil, fmt.Errorf("empty InnoDB status")
+	}
+
+	// Text protocol values are sub-slices of the row packet, so the
+	// status blob is parsed in place rather than copied into a string.
+	v, err := r.Resultset.GetValueByName(0, "Status")
+	if err != nil {
+		return nil, err
+	}
+	status, ok := v.([]byte)
+	if !ok {
+		return nil, fmt.Errorf("unexpected InnoDB status type %T", v)
+	}
+
+	c.status.parse(status)
+	s := &c.status
+
+	c.log.Debug("gathered innodb status",
+		"history_list_length", s.historyListLength,
+		"log_sequence_number", s.logSequenceNumber,
+		"last_checkpoint", s.lastCheckpoint,
+		"pending_reads", s.pendingReads,
+		"pending_writes", s.pendingWrites,
+		"pending_fsyncs", s.pendingFsyncs,
+		"semaphore_waits", s.semaphoreWaits)
+
+	events := []*raidman.Event{
+		newMetricEvent(t, "mysql/innodb/semaphore_waits", int64(s.semaphoreWaits)),
+	}
+	if s.seen&innodbSeenHistoryListLength != 0 {
+		events = append(events, newMetricEvent(t, "mysql/innodb/history_list_length", int64(s.historyListLength)))
+	}
+	if s.seen&innodbSeenLogSequenceNumber != 0 && s.seen&innodbSeenLastCheckpoint != 0 &&
+		s.logSequenceNumber >= s.lastCheckpoint {
+		events = append(events, newMetricEvent(t, "mysql/innodb/checkpoint_age", int64(s.logSequenceNumber-s.lastCheckpoint)))
+	}
+	if s.seen&innodbSeenPendingReads != 0 {
+		events = append(events, newMetricEvent(t, "mysql/innodb/pending_reads", int64(s.pendingReads)))
+	}
+	if s.seen&innodbSeenPendingWrites != 0 {
+		events = append(events, newMetricEvent(t, "mysql/innodb/pending_writes", int64(s.pendingWrites)))
+	}
+	if s.seen&innodbSeenPendingFlushes != 0 {
+		events = append(events, newMetricEvent(t, "mysql/innodb/pending_fsyncs", int64(s.pendingFsyncs)))
+	}
+
+	return events, nil
+}
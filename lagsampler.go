@@ -0,0 +1,266 @@
+package main
+
+import (
+	"fmt"
+	"math"
+	"sort"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+	"gopkg.in/tomb.v2"
+)
+
+// lagAggregate summarizes the lag samples of a single replication
+// connection over a reporting interval.
+type lagAggregate struct {
+	min, max, mean, p99 float64
+	count               int
+}
+
+// lagSamples accumulates lag samples between two reports. Sample slices
+// are truncated rather than reallocated on drain, so that steady-state
+// sampling does not allocate.
+type lagSamples struct {
+	sync.Mutex
+	samples map[string]*[]float64
+	scratch []float64
+}
+
+// add records a sample under key. Keys may point into a reused result
+// buffer, they are copied when first seen and never stored again.
+func (l *lagSamples) add(key string, v float64) {
+	l.Lock()
+	samples, ok := l.samples[key]
+	if !ok {
+		samples = new([]float64)
+		l.samples[string(append([]byte(nil), key...))] = samples
+	}
+	*samples = append(*samples, v)
+	l.Unlock()
+}
+
+// drain computes the aggregates of all accumulated samples and resets them.
+func (l *lagSamples) drain() map[string]lagAggregate {
+	l.Lock()
+	defer l.Unlock()
+
+	aggs := make(map[string]lagAggregate, len(l.samples))
+	for key, samples := range l.samples {
+		if len(*samples) == 0 {
+			delete(l.samples, key)
+			continue
+		}
+
+		l.scratch = append(l.scratch[:0], *samples...)
+		sort.Float64s(l.scratch)
+
+		sum := 0.0
+		for _, v := range l.scratch {
+			sum += v
+		}
+
+		n := len(l.scratch)
+		aggs[key] = lagAggregate{
+			min:   l.scratch[0],
+			max:   l.scratch[n-1],
+			mean:  sum / float64(n),
+			p99:   l.scratch[int(math.Ceil(0.99*float64(n)))-1],
+			count: n,
+		}
+
+		*samples = (*samples)[:0]
+	}
+
+	return aggs
+}
+
+// reset discards all accumulated samples.
+func (l *lagSamples) reset() {
+	l.Lock()
+	for key := range l.samples {
+		delete(l.samples, key)
+	}
+	l.Unlock()
+}
+
+// lagSampleKey returns the key under which samples of the replication
+// connection at row i are recorded: the primary's server id in heartbeat
+// mode, the connection name otherwise.
+func (tg *target) lagSampleKey(rs *gomysql.Resultset, i int, cols *replicationColumns) (string, error) {
+	if tg.heartbeatTable != "" {
+		id, err := rs.ColumnInt64(i, cols.masterServerID)
+		if err != nil {
+			return "", err
+		}
+		return strconv.FormatInt(id, 10), nil
+	}
+
+	return connectionKey(rs, i, cols.connectionName), nil
+}
+
+// connectionKey returns the name of the replication connection at row i,
+// or conn<i> for the default connection and for servers which do not name
+// connections, such as MySQL with SHOW SLAVE STATUS.
+func connectionKey(rs *gomysql.Resultset, i int, nameCol gomysql.Column) string {
+	if nameCol != gomysql.NoColumn {
+		if name, _ := rs.ColumnString(i, nameCol); name != "" {
+			return name
+		}
+	}
+	return "conn" + strconv.Itoa(i)
+}
+
+// lagSampleLoop samples replication lag every lag_sample_interval on a
+// dedicated connection. In heartbeat mode the heartbeat query is prepared
+// once per connection and reused for every sample.
+func (tg *target) lagSampleLoop(t *tomb.Tomb) error {
+	var (
+		db   *mysql.Conn
+		stmt *mysql.Stmt
+		err  error
+	)
+
+	reset := func() {
+		if db != nil {
+			db.Close()
+		}
+		db, stmt = nil, nil
+	}
+
+	var retryAt time.Time
+	retry := newBackoff(reconnectBackoff, maxReconnectBackoff)
+	tick := time.NewTicker(tg.lagSampleInterval)
+	defer tick.Stop()
+
+	for {
+		select {
+		case now := <-tick.C:
+			// A primary has no lag to sample, in heartbeat mode it
+			// would only read back its own heartbeats.
+			if atomic.LoadInt32(&tg.primary) != 0 {
+				continue
+			}
+
+			if db == nil {
+				if now.Before(retryAt) {
+					continue
+				}
+				if db, err = tg.getDbHandle(nil); err != nil {
+					delay := retry.next()
+					retryAt = now.Add(delay)
+					tg.log.Warn("unable to get lag sampling database handle", "error", err, "retry", delay)
+					continue
+				}
+				retry.reset()
+			} else if err = tg.setDeadline(db); err != nil {
+				tg.log.Warn("unable to set lag sampling deadline", "error", err)
+				reset()
+				continue
+			}
+
+			if tg.heartbeatTable != "" {
+				if stmt == nil {
+					if stmt, err = db.Prepare(fmt.Sprintf("SELECT server_id, ts FROM %s", tg.heartbeatTable)); err != nil {
+						tg.log.Warn("unable to prepare lag sampling query", "error", err)
+						reset()
+						continue
+					}
+				}
+				err = tg.sampleHeartbeatLag(stmt)
+			} else {
+				err = tg.sampleReplicationLag(db)
+			}
+
+			if err != nil {
+				tg.log.Warn("unable to sample replication lag", "error", err)
+				reset()
+			}
+
+		case <-t.Dying():
+			reset()
+			return nil
+		}
+	}
+}
+
+func (tg *target) sampleHeartbeatLag(stmt *mysql.Stmt) error {
+	r, err := stmt.Execute()
+	if err != nil {
+		return err
+	}
+
+	now := time.Now()
+	for i := 0; i < r.Resultset.RowNumber(); i++ {
+		id, err := r.Resultset.GetInt(i, 0)
+		if err != nil {
+			return err
+		}
+
+		ts, err := r.Resultset.GetString(i, 1)
+		if err != nil {
+			return err
+		}
+
+		lag, err := heartbeatLag(ts, now)
+		if err != nil {
+			return err
+		}
+
+		tg.sampledLag.add(strconv.FormatInt(id, 10), lag)
+	}
+
+	return nil
+}
+
+func (tg *target) sampleReplicationLag(db *mysql.Conn) error {
+	r, err := db.ExecuteReuse(tg.replicationQuery, tg.lagResult)
+	if err != nil {
+		return err
+	}
+	tg.lagResult = r
+
+	rs := r.Resultset
+	lagCol, nameCol := rs.Column("Seconds_Behind_Master"), rs.Column("Connection_name")
+	for i := 0; i < rs.RowNumber(); i++ {
+		// A NULL lag means the SQL thread is stopped, which is
+		// reported by the polling loop.
+		if null, _ := rs.ColumnIsNull(i, lagCol); null {
+			continue
+		}
+
+		secondsBehind, err := rs.ColumnInt64(i, lagCol)
+		if err != nil {
+			return err
+		}
+
+		tg.sampledLag.add(connectionKey(rs, i, nameCol), float64(secondsBehind))
+	}
+
+	return nil
+}
+
+// lagSampleEvent builds the aggregated lag event of a replication
+// connection alongside its replication event. The metric is the maximum
+// lag seen over the interval, other aggregates are sent as attributes.
+func lagSampleEvent(agg lagAggregate, repl *raidman.Event) *raidman.Event {
+	return &raidman.Event{
+		Time:    repl.Time,
+		Service: repl.Service + "/lag",
+		State:   "ok",
+		Metric:  agg.max,
+		Description: fmt.Sprintf("lag min: %.6fs, mean: %.6fs, p99: %.6fs, max: %.6fs over %d samples",
+			agg.min, agg.mean, agg.p99, agg.max, agg.count),
+		Attributes: map[string]string{
+			"min":     strconv.FormatFloat(agg.min, 'f', 6, 64),
+			"mean":    strconv.FormatFloat(agg.mean, 'f', 6, 64),
+			"p99":     strconv.FormatFloat(agg.p99, 'f', 6, 64),
+			"max":     strconv.FormatFloat(agg.max, 'f', 6, 64),
+			"samples": strconv.Itoa(agg.count),
+		},
+	}
+}
@@ -0,0 +1,325 @@
+package main
+
+import (
+	"net"
+	"net/http"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/amir/raidman"
+)
+
+// metricsServer serves the latest events of all targets on /metrics, in
+// the Prometheus text format. Targets publish pre-encoded snapshots after
+// each poll, so that scrapes neither query MySQL nor wait for polls, and
+// cost the same however often they happen.
+type metricsServer struct {
+	sync.Mutex
+
+	addr   string
+	server *http.Server
+
+	// enabled is set while the server listens, targets do not encode
+	// snapshots otherwise.
+	enabled int32
+	// buffers holds the []*metricsBuffer of running targets, it is
+	// replaced rather than modified so that scrapes read it without
+	// locking.
+	buffers atomic.Value
+}
+
+var metrics = new(metricsServer)
+
+// setAddr starts serving on addr, or stops serving when addr is empty.
+func (m *metricsServer) setAddr(addr string) {
+	m.Lock()
+	defer m.Unlock()
+
+	if addr == m.addr {
+		return
+	}
+
+	if m.server != nil {
+		m.server.Close()
+		m.server = nil
+		atomic.StoreInt32(&m.enabled, 0)
+	}
+	m.addr = addr
+	if addr == "" {
+		return
+	}
+
+	ln, err := net.Listen("tcp", addr)
+	if err != nil {
+		log.Error("unable to serve metrics", "address", addr, "error", err)
+		return
+	}
+
+	mux := http.NewServeMux()
+	mux.Handle("/metrics", m)
+	m.server = &http.Server{Handler: mux}
+	atomic.StoreInt32(&m.enabled, 1)
+
+	log.Info("serving metrics", "address", ln.Addr())
+	go m.server.Serve(ln)
+}
+
+func (m *metricsServer) close() {
+	m.setAddr("")
+}
+
+func (m *metricsServer) register(b *metricsBuffer) {
+	m.Lock()
+	defer m.Unlock()
+
+	buffers, _ := m.buffers.Load().([]*metricsBuffer)
+	m.buffers.Store(append(buffers[:len(buffers):len(buffers)], b))
+}
+
+func (m *metricsServer) unregister(b *metricsBuffer) {
+	m.Lock()
+	defer m.Unlock()
+
+	buffers, _ := m.buffers.Load().([]*metricsBuffer)
+	kept := make([]*metricsBuffer, 0, len(buffers))
+	for _, other := range buffers {
+		if other != b {
+			kept = append(kept, other)
+		}
+	}
+	m.buffers.Store(kept)
+}
+
+func (m *metricsServer) ServeHTTP(w http.ResponseWriter, r *http.Request) {
+	w.Header().Set("Content-Type", "text/plain; version=0.0.4")
+
+	now := time.Now()
+	buffers, _ := m.buffers.Load().([]*metricsBuffer)
+	for _, b := range buffers {
+		s := b.acquire()
+		if s == nil {
+			continue
+		}
+		// Like Riemann events, values of targets which stopped polling
+		// expire.
+		if now.Before(s.expires) {
+			w.Write(s.data)
+		}
+		s.release()
+	}
+}
+
+// metricsSnapshot holds the encoded events of a poll.
+type metricsSnapshot struct {
+	data    []byte
+	expires time.Time
+	// readers counts the scrapes writing data out.
+	readers int32
+}
+
+func (s *metricsSnapshot) release() {
+	atomic.AddInt32(&s.readers, -1)
+}
+
+// metricsBuffer double-buffers the snapshots of a target: the polling
+// loop encodes into the snapshot which is not current and swaps them.
+// A snapshot still being written out by a slow scrape is not reused.
+type metricsBuffer struct {
+	current atomic.Value
+	// back is only accessed by the polling loop.
+	back *metricsSnapshot
+}
+
+func (b *metricsBuffer) publish(events []*raidman.Event, ttl time.Duration) {
+	if atomic.LoadInt32(&metrics.enabled) == 0 {
+		return
+	}
+
+	s := b.back
+	if s == nil || atomic.LoadInt32(&s.readers) != 0 {
+		s = new(metricsSnapshot)
+	}
+	s.data = appendMetrics(s.data[:0], events)
+	s.expires = time.Now().Add(ttl)
+
+	b.back, _ = b.current.Load().(*metricsSnapshot)
+	b.current.Store(s)
+}
+
+// acquire returns the current snapshot, which must be released once
+// written out, or nil when none was published.
+func (b *metricsBuffer) acquire() *metricsSnapshot {
+	for {
+		s, _ := b.current.Load().(*metricsSnapshot)
+		if s == nil {
+			return nil
+		}
+
+		atomic.AddInt32(&s.readers, 1)
+		// The snapshot may have been swapped out and be encoded into
+		// again before it was marked as read.
+		if cur, _ := b.current.Load().(*metricsSnapshot); cur == s {
+			return s
+		}
+		s.release()
+	}
+}
+
+// appendMetrics encodes the events which carry a metric. Metric names are
+// fixed, and the variable parts of services, such as replication
+// connections, digests, schemas and tables, are sent as labels, see
+// metricLabels.
+func appendMetrics(dst []byte, events []*raidman.Event) []byte {
+	var (
+		num    [32]byte
+		labels [2]metricLabel
+	)
+
+	for _, event := range events {
+		value, ok := appendMetricValue(num[:0], event.Metric)
+		if !ok {
+			continue
+		}
+
+		var n int
+		dst, n = appendMetricName(dst, event, labels[:])
+
+		dst = append(dst, `{host="`...)
+		dst = appendLabelValue(dst, event.Host)
+		dst = append(dst, '"')
+		for _, l := range labels[:n] {
+			dst = append(dst, ',')
+			dst = append(dst, l.name...)
+			dst = append(dst, `="`...)
+			dst = appendLabelValue(dst, l.value)
+			dst = append(dst, '"')
+		}
+		dst = append(dst, "} "...)
+
+		dst = append(dst, value...)
+		dst = append(dst, '\n')
+	}
+
+	return dst
+}
+
+// metricLabel is a label of a metric, taken from a variable part of the
+// service of its event.
+type metricLabel struct {
+	name, value string
+}
+
+// appendMetricName encodes the metric name of an event, which is its
+// service with slashes replaced by underscores once the variable parts are
+// taken out as labels, into labels. It returns the number of labels.
+//
+//	mysql/replication/<connection>[/...]      mysql_replication[_...]{connection}
+//	mysql/digest/<schema>/<digest>            mysql_digest{schema,digest}
+//	mysql/tablesize/<schema>/<kind>           mysql_tablesize_<kind>{schema}
+//	mysql/tablesize/<schema>/<table>/<kind>   mysql_tablesize_table_<kind>{schema,table}
+//	mysql/processlist/<command|state>/<name>  mysql_processlist_<command|state>{command|state}
+//	mysql/workers/<channel>/<name>            mysql_workers_<name>{channel}
+func appendMetricName(dst []byte, event *raidman.Event, labels []metricLabel) ([]byte, int) {
+	var (
+		parts [6]string
+		n     int
+	)
+	for s := event.Service; n < len(parts); n++ {
+		i := strings.IndexByte(s, '/')
+		if i < 0 || n == len(parts)-1 {
+			parts[n] = s
+			n++
+			break
+		}
+		parts[n], s = s[:i], s[i+1:]
+	}
+
+	var (
+		name    [6]string
+		nname   int
+		nlabels int
+	)
+	label := func(name, value string) {
+		labels[nlabels] = metricLabel{name, value}
+		nlabels++
+	}
+	named := func(parts ...string) {
+		nname += copy(name[nname:], parts)
+	}
+
+	switch {
+	case n >= 3 && parts[1] == "replication":
+		label("connection", parts[2])
+		named(parts[0], parts[1])
+		named(parts[3:n]...)
+	case n == 4 && parts[1] == "digest":
+		label("schema", parts[2])
+		label("digest", parts[3])
+		named(parts[0], parts[1])
+	case n == 4 && parts[1] == "tablesize":
+		label("schema", parts[2])
+		named(parts[0], parts[1], parts[3])
+	case n == 5 && parts[1] == "tablesize":
+		label("schema", parts[2])
+		label("table", parts[3])
+		named(parts[0], parts[1], "table", parts[4])
+	case n == 4 && parts[1] == "processlist" && (parts[2] == "command" || parts[2] == "state"):
+		label(parts[2], parts[3])
+		named(parts[0], parts[1], parts[2])
+	case n == 4 && parts[1] == "workers":
+		label("channel", parts[2])
+		named(parts[0], parts[1], parts[3])
+	default:
+		named(parts[:n]...)
+	}
+
+	for i, part := range name[:nname] {
+		if i > 0 {
+			dst = append(dst, '_')
+		}
+		for j := 0; j < len(part); j++ {
+			c := part[j]
+			if !('a' <= c && c <= 'z' || 'A' <= c && c <= 'Z' || '0' <= c && c <= '9' || c == '_' || c == ':') {
+				c = '_'
+			}
+			dst = append(dst, c)
+		}
+	}
+
+	return dst, nlabels
+}
+
+// appendMetricValue encodes the metric of an event, it reports false for
+// events without one.
+func appendMetricValue(dst []byte, metric interface{}) ([]byte, bool) {
+	switch v := metric.(type) {
+	case int:
+		return strconv.AppendInt(dst, int64(v), 10), true
+	case int64:
+		return strconv.AppendInt(dst, v, 10), true
+	case uint64:
+		return strconv.AppendUint(dst, v, 10), true
+	case float32:
+		return strconv.AppendFloat(dst, float64(v), 'g', -1, 32), true
+	case float64:
+		return strconv.AppendFloat(dst, v, 'g', -1, 64), true
+	}
+	return dst, false
+}
+
+func appendLabelValue(dst []byte, v string) []byte {
+	for i := 0; i < len(v); i++ {
+		switch c := v[i]; c {
+		case '\\', '"':
+			dst = append(dst, '\\', c)
+		case '\n':
+			dst = append(dst, '\\', 'n')
+		default:
+			dst = append(dst, c)
+		}
+	}
+	return dst
+}
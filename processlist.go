@@ -0,0 +1,147 @@
+package main
+
+import (
+	"fmt"
+	"strings"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+	"gopkg.in/inconshreveable/log15.v2"
+)
+
+// Thread and transaction lists are aggregated by the server, so that the
+// result size does not depend on the number of connections.
+const (
+	processlistQuery = "SELECT COMMAND, STATE, COUNT(*) " +
+		"FROM information_schema.PROCESSLIST GROUP BY COMMAND, STATE"
+	trxQuery = "SELECT COUNT(*), " +
+		"COALESCE(MAX(TIMESTAMPDIFF(SECOND, trx_started, NOW())), 0), " +
+		"COALESCE(SUM(trx_state = 'LOCK WAIT'), 0), " +
+		"COALESCE(MAX(TIMESTAMPDIFF(SECOND, trx_wait_started, NOW())), 0) " +
+		"FROM information_schema.INNODB_TRX"
+)
+
+var processlistQueries = []string{processlistQuery, trxQuery}
+
+type processlistCollector struct {
+	log      log15.Logger
+	commands map[string]int64
+	states   map[string]int64
+}
+
+func newProcesslistCollector(settings collectorSettings, logger log15.Logger) (collector, error) {
+	return &processlistCollector{
+		log:      logger,
+		commands: make(map[string]int64),
+		states:   make(map[string]int64),
+	}, noSettings(settings)
+}
+
+func (c *processlistCollector) name() string {
+	return "processlist"
+}
+
+func (c *processlistCollector) queries() []string {
+	return processlistQueries
+}
+
+func (c *processlistCollector) collect(db *mysql.Conn, t time.Time) ([]*raidman.Event, error) {
+	results, err := executeAll(db, processlistQueries)
+	if err != nil {
+		return nil, err
+	}
+	return c.process(results, t)
+}
+
+func (c *processlistCollector) process(results []*gomysql.Result, t time.Time) ([]*raidman.Event, error) {
+	r := results[0]
+
+	// Commands and states seen during a previous poll are reported as 0
+	// until they are forgotten, so that their metric does not stall at its
+	// last value.
+	for k, n := range c.commands {
+		if n == 0 {
+			delete(c.commands, k)
+		} else {
+			c.commands[k] = 0
+		}
+	}
+	for k, n := range c.states {
+		if n == 0 {
+			delete(c.states, k)
+		} else {
+			c.states[k] = 0
+		}
+	}
+
+	var threads int64
+	for i := 0; i < r.Resultset.RowNumber(); i++ {
+		command, _ := r.Resultset.GetString(i, 0)
+		state, _ := r.Resultset.GetString(i, 1)
+		n, err := r.Resultset.GetInt(i, 2)
+		if err != nil {
+			return nil, err
+		}
+
+		c.commands[serviceName(command)] += n
+		c.states[serviceName(state)] += n
+		threads += n
+	}
+
+	r = results[1]
+	if r.Resultset.RowNumber() != 1 {
+		return nil, fmt.Errorf("unexpected transaction summary of %d rows", r.Resultset.RowNumber())
+	}
+
+	var (
+		trx [4]int64
+		err error
+	)
+	for i := range trx {
+		if trx[i], err = r.Resultset.GetInt(0, i); err != nil {
+			return nil, err
+		}
+	}
+
+	c.log.Debug("gathered processlist",
+		"threads", threads,
+		"transactions", trx[0],
+		"oldest_transaction", trx[1],
+		"lock_waits", trx[2],
+		"longest_lock_wait", trx[3])
+
+	events := make([]*raidman.Event, 0, len(c.commands)+len(c.states)+5)
+	events = append(events,
+		newMetricEvent(t, "mysql/processlist/threads", threads),
+		newMetricEvent(t, "mysql/processlist/transactions", trx[0]),
+		newMetricEvent(t, "mysql/processlist/oldest_transaction", trx[1]),
+		newMetricEvent(t, "mysql/processlist/lock_waits", trx[2]),
+		newMetricEvent(t, "mysql/processlist/longest_lock_wait", trx[3]))
+
+	for command, n := range c.commands {
+		events = append(events, newMetricEvent(t, "mysql/processlist/command/"+command, n))
+	}
+	for state, n := range c.states {
+		events = append(events, newMetricEvent(t, "mysql/processlist/state/"+state, n))
+	}
+
+	return events, nil
+}
+
+// serviceName turns a free form server string, such as a thread state,
+// into a lowercase service name component.
+func serviceName(s string) string {
+	if s = strings.TrimSpace(s); s == "" {
+		return "none"
+	}
+
+	return strings.Map(func(r rune) rune {
+		switch r {
+		case ' ', '/':
+			return '_'
+		}
+		return r
+	}, strings.ToLower(s))
+}
@@ -0,0 +1,103 @@
+package main
+
+import (
+	"reflect"
+)
+
+// targetSet holds the running targets along with the configuration they
+// were started from, which reloaded configurations are compared to.
+type targetSet map[string]*runningTarget
+
+type runningTarget struct {
+	*target
+
+	config   *targetConfig
+	settings map[string]collectorSettings
+}
+
+// apply starts, stops, retunes or restarts targets so that they match
+// cfg. Targets whose configuration did not change are left alone and keep
+// their connections and state.
+func (s targetSet) apply(cfg *config) {
+	seen := make(map[string]bool, len(cfg.targets))
+
+	for _, c := range cfg.targets {
+		seen[c.name] = true
+		settings := cfg.settingsOf(c)
+
+		rt, ok := s[c.name]
+		switch {
+		case !ok:
+			s.start(c, settings)
+
+		case rt.config.equal(c) && reflect.DeepEqual(rt.settings, settings):
+			continue
+
+		case rt.config.sameConnection(c):
+			rt.update(&targetUpdate{config: c.clone(), settings: settings})
+			rt.config, rt.settings = c, settings
+
+		default:
+			rt.log.Info("restarting")
+			rt.stop()
+			s.start(c, settings)
+		}
+	}
+
+	for name, rt := range s {
+		if !seen[name] {
+			rt.log.Info("removing")
+			rt.stop()
+			delete(s, name)
+		}
+	}
+}
+
+func (s targetSet) start(c *targetConfig, settings map[string]collectorSettings) {
+	tg, err := newTarget(c.clone(), settings)
+	if err != nil {
+		log.Error("unable to set up target", "target", c.name, "error", err)
+		delete(s, c.name)
+		return
+	}
+
+	s[c.name] = &runningTarget{target: tg, config: c, settings: settings}
+	tg.start()
+}
+
+func (s targetSet) stop() {
+	for _, rt := range s {
+		rt.stop()
+	}
+}
+
+// reloadConfig parses the configuration file again and applies it to the
+// running targets, along with the targets discovered from its sources.
+// It returns the discovery of the new configuration. An invalid file
+// leaves the current configuration in place.
+func reloadConfig(targets targetSet, disc *discovery) *discovery {
+	if configFile == "" {
+		log.Warn("no configuration file to reload")
+		return disc
+	}
+
+	log.Info("reloading configuration", "path", configFile)
+	c, err := loadConfig(configFile)
+	if err != nil {
+		log.Error("unable to reload configuration, keeping the current one", "error", err)
+		return disc
+	}
+
+	if disc == nil || disc.dir != c.targetDir || disc.sockets != c.targetSockets {
+		disc.close()
+		disc = newDiscovery(c)
+	}
+
+	sinks.configure(c)
+	metrics.setAddr(c.metricsListen)
+	dials.resize(c.dialConcurrency)
+	targets.apply(c.withDiscovered(disc.targets(c)))
+	cfg = c
+
+	return disc
+}
@@ -0,0 +1,46 @@
+package main
+
+import (
+	"github.com/amir/raidman"
+)
+
+// riemannSink sends events to Riemann. The connection is dialed again on
+// the next send after a failure.
+type riemannSink struct {
+	addr   string
+	client *raidman.Client
+}
+
+func newRiemannSink(addr string) sink {
+	return &riemannSink{addr: addr}
+}
+
+func (r *riemannSink) name() string {
+	return "riemann"
+}
+
+func (r *riemannSink) send(events []*raidman.Event) error {
+	if r.client == nil {
+		// The timeout also bounds each send.
+		client, err := raidman.DialWithTimeout("tcp4", r.addr, sinkTimeout)
+		if err != nil {
+			return err
+		}
+		r.client = client
+	}
+
+	if err := r.client.SendMulti(events); err != nil {
+		r.client.Close()
+		r.client = nil
+		return err
+	}
+
+	return nil
+}
+
+func (r *riemannSink) close() {
+	if r.client != nil {
+		r.client.Close()
+		r.client = nil
+	}
+}
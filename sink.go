@@ -0,0 +1,165 @@
+package main
+
+import (
+	"net"
+	"sync"
+	"time"
+
+	"github.com/amir/raidman"
+)
+
+const (
+	// sinkQueueLength is the number of polls a sink may fall behind
+	// before their events are dropped.
+	sinkQueueLength = 64
+	// sinkTimeout bounds the writes of network sinks.
+	sinkTimeout = 10 * time.Second
+)
+
+// A sink delivers events to a monitoring system. Sinks are only ever
+// called from their own goroutine, see sinkQueue.
+type sink interface {
+	name() string
+	send(events []*raidman.Event) error
+	close()
+}
+
+// sinkQueue runs a sink in its own goroutine behind a bounded queue of
+// batches, so that a slow sink delays neither polls nor other sinks.
+// Batches which queued up during a send are sent together.
+type sinkQueue struct {
+	sink  sink
+	addr  string
+	queue chan []*raidman.Event
+	done  chan struct{}
+}
+
+func newSinkQueue(s sink, addr string) *sinkQueue {
+	q := &sinkQueue{
+		sink:  s,
+		addr:  addr,
+		queue: make(chan []*raidman.Event, sinkQueueLength),
+		done:  make(chan struct{}),
+	}
+	go q.run()
+	return q
+}
+
+// publish queues events, which must not be modified afterwards.
+func (q *sinkQueue) publish(events []*raidman.Event) {
+	select {
+	case q.queue <- events:
+	default:
+		log.Warn("sink is falling behind, dropping events", "sink", q.sink.name(), "events", len(events))
+	}
+}
+
+func (q *sinkQueue) run() {
+	defer close(q.done)
+	defer q.sink.close()
+
+	var batch []*raidman.Event
+	for events := range q.queue {
+		batch = append(batch[:0], events...)
+
+	drain:
+		for {
+			select {
+			case events, ok := <-q.queue:
+				if !ok {
+					break drain
+				}
+				batch = append(batch, events...)
+			default:
+				break drain
+			}
+		}
+
+		log.Debug("sending events", "sink", q.sink.name(), "events", len(batch))
+		if err := q.sink.send(batch); err != nil {
+			log.Error("unable to send events", "sink", q.sink.name(), "error", err)
+		}
+	}
+}
+
+// stop sends the queued events and stops the sink.
+func (q *sinkQueue) stop() {
+	close(q.queue)
+	<-q.done
+}
+
+// sinkSet holds the configured sinks, which the events of all targets
+// are fanned out to.
+type sinkSet struct {
+	sync.RWMutex
+	queues map[string]*sinkQueue
+}
+
+var sinks = &sinkSet{queues: make(map[string]*sinkQueue)}
+
+// configure starts the sinks of cfg, and restarts or stops the running
+// ones whose settings changed. Queues are swapped under the lock but
+// stopped outside of it, so that a sink stuck sending delays neither
+// polls publishing events nor the caller longer than its send.
+func (s *sinkSet) configure(cfg *config) {
+	s.Lock()
+	stopped := []*sinkQueue{
+		s.set("riemann", net.JoinHostPort(cfg.riemannHost, cfg.riemannPort), newRiemannSink),
+		s.set("graphite", sinkAddr(cfg.graphiteHost, cfg.graphitePort), newGraphiteSink),
+		s.set("statsd", sinkAddr(cfg.statsdHost, cfg.statsdPort), newStatsdSink),
+	}
+	s.Unlock()
+
+	for _, q := range stopped {
+		if q != nil {
+			log.Info("stopping sink", "sink", q.sink.name(), "address", q.addr)
+			q.stop()
+		}
+	}
+}
+
+// set runs the sink named name on addr, or removes it when addr is empty.
+// It returns the queue it replaced, which the caller must stop.
+func (s *sinkSet) set(name, addr string, newSink func(addr string) sink) *sinkQueue {
+	q := s.queues[name]
+	if q != nil && q.addr == addr {
+		return nil
+	}
+
+	delete(s.queues, name)
+	if addr != "" {
+		log.Info("starting sink", "sink", name, "address", addr)
+		s.queues[name] = newSinkQueue(newSink(addr), addr)
+	}
+	return q
+}
+
+// publish fans events out to all sinks.
+func (s *sinkSet) publish(events []*raidman.Event) {
+	s.RLock()
+	defer s.RUnlock()
+
+	for _, q := range s.queues {
+		q.publish(events)
+	}
+}
+
+func (s *sinkSet) close() {
+	s.Lock()
+	queues := s.queues
+	s.queues = make(map[string]*sinkQueue)
+	s.Unlock()
+
+	for _, q := range queues {
+		q.stop()
+	}
+}
+
+// sinkAddr returns the address of an optional sink, which is empty when
+// the sink has no host.
+func sinkAddr(host, port string) string {
+	if host == "" {
+		return ""
+	}
+	return net.JoinHostPort(host, port)
+}
@@ -0,0 +1,182 @@
+package main
+
+import (
+	"fmt"
+	"strconv"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+	"gopkg.in/inconshreveable/log15.v2"
+)
+
+const (
+	tableSizeSchemasQuery = "SELECT SCHEMA_NAME FROM information_schema.SCHEMATA WHERE SCHEMA_NAME NOT IN " +
+		"('information_schema', 'performance_schema', 'mysql', 'sys')"
+	tableSizeTablesQuery = "SELECT TABLE_NAME, COALESCE(DATA_LENGTH, 0), COALESCE(INDEX_LENGTH, 0) " +
+		"FROM information_schema.TABLES WHERE TABLE_SCHEMA = '%s'"
+)
+
+type tableSize struct {
+	data, index int64
+}
+
+// schemaSizes holds the last known table sizes of a schema.
+type schemaSizes struct {
+	tables  map[string]tableSize
+	total   tableSize
+	scanned time.Time
+}
+
+// tableSizeCollector scans a single schema per poll, in round-robin. Sizes
+// of the other schemas are reported from the last scan, so that each poll
+// emits a complete, partly stale, picture at the cost of one schema scan.
+type tableSizeCollector struct {
+	log      log15.Logger
+	perTable bool
+
+	schemas map[string]*schemaSizes
+	order   []string
+	next    int
+}
+
+func newTableSizeCollector(settings collectorSettings, logger log15.Logger) (collector, error) {
+	c := &tableSizeCollector{log: logger, schemas: make(map[string]*schemaSizes)}
+
+	for k, v := range settings {
+		switch k {
+		case "per_table":
+			b, err := strconv.ParseBool(v)
+			if err != nil {
+				return nil, fmt.Errorf("invalid value %q for setting `per_table`", v)
+			}
+			c.perTable = b
+
+		default:
+			return nil, fmt.Errorf("unsupported setting %q", k)
+		}
+	}
+
+	return c, nil
+}
+
+func (c *tableSizeCollector) name() string {
+	return "tablesize"
+}
+
+func (c *tableSizeCollector) collect(db *mysql.Conn, t time.Time) ([]*raidman.Event, error) {
+	if c.next >= len(c.order) {
+		if err := c.listSchemas(db); err != nil {
+			return nil, err
+		}
+	}
+
+	if c.next < len(c.order) {
+		schema := c.order[c.next]
+		c.next++
+
+		if err := c.scanSchema(db, schema, t); err != nil {
+			return nil, err
+		}
+	}
+
+	var events []*raidman.Event
+	for schema, sizes := range c.schemas {
+		age := strconv.FormatFloat(t.Sub(sizes.scanned).Seconds(), 'f', 0, 64)
+
+		events = append(events,
+			tableSizeEvent(t, "mysql/tablesize/"+schema+"/data", sizes.total.data, age),
+			tableSizeEvent(t, "mysql/tablesize/"+schema+"/index", sizes.total.index, age))
+
+		if !c.perTable {
+			continue
+		}
+		for table, size := range sizes.tables {
+			events = append(events,
+				tableSizeEvent(t, "mysql/tablesize/"+schema+"/"+table+"/data", size.data, age),
+				tableSizeEvent(t, "mysql/tablesize/"+schema+"/"+table+"/index", size.index, age))
+		}
+	}
+
+	return events, nil
+}
+
+// listSchemas starts a new round-robin cycle over the current schemas,
+// forgetting the ones which were dropped.
+func (c *tableSizeCollector) listSchemas(db *mysql.Conn) error {
+	r, err := db.Execute(tableSizeSchemasQuery)
+	if err != nil {
+		return err
+	}
+
+	seen := make(map[string]bool, r.Resultset.RowNumber())
+	c.order = c.order[:0]
+	for i := 0; i < r.Resultset.RowNumber(); i++ {
+		schema, err := r.Resultset.GetString(i, 0)
+		if err != nil {
+			return err
+		}
+		schema = string([]byte(schema))
+
+		c.order = append(c.order, schema)
+		seen[schema] = true
+	}
+
+	for schema := range c.schemas {
+		if !seen[schema] {
+			delete(c.schemas, schema)
+		}
+	}
+
+	c.next = 0
+	c.log.Debug("listed schemas for table sizes", "schemas", len(c.order))
+	return nil
+}
+
+func (c *tableSizeCollector) scanSchema(db *mysql.Conn, schema string, t time.Time) error {
+	sizes := &schemaSizes{
+		tables:  make(map[string]tableSize),
+		scanned: t,
+	}
+
+	_, err := db.ExecuteStreaming(fmt.Sprintf(tableSizeTablesQuery, gomysql.Escape(schema)),
+		func(row []interface{}) error {
+			table, ok := row[0].([]byte)
+			if !ok {
+				return fmt.Errorf("unexpected table name type %T", row[0])
+			}
+
+			data, err := rowInt(row[1])
+			if err != nil {
+				return err
+			}
+			index, err := rowInt(row[2])
+			if err != nil {
+				return err
+			}
+
+			// Table names are only kept when they are reported.
+			if c.perTable {
+				sizes.tables[string(table)] = tableSize{data, index}
+			}
+			sizes.total.data += data
+			sizes.total.index += index
+			return nil
+		})
+	if err != nil {
+		return err
+	}
+
+	c.log.Debug("scanned table sizes", "schema", schema,
+		"data", sizes.total.data,
+		"index", sizes.total.index)
+	c.schemas[schema] = sizes
+	return nil
+}
+
+func tableSizeEvent(t time.Time, service string, size int64, age string) *raidman.Event {
+	event := newMetricEvent(t, service, size)
+	event.Attributes = map[string]string{"age": age}
+	return event
+}
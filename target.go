@@ -0,0 +1,628 @@
+package main
+
+import (
+	"context"
+	"crypto/tls"
+	"errors"
+	"fmt"
+	"math"
+	"net"
+	"os"
+	"reflect"
+	"strings"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	gomysql "github.com/siddontang/go-mysql/mysql"
+	"gopkg.in/inconshreveable/log15.v2"
+	"gopkg.in/tomb.v2"
+)
+
+// target is a monitored MySQL server. Each target polls on its own
+// goroutines and keeps its own connections and per-connection state, so
+// that targets do not interfere with each other.
+type target struct {
+	*targetConfig
+
+	log  log15.Logger
+	tomb tomb.Tomb
+
+	tls       *tls.Config
+	serverKey serverKey
+	conns     connSet
+
+	collectors []collector
+	// collectorSettings holds the settings collectors were built with.
+	collectorSettings map[string]collectorSettings
+	// updates carries reloaded configurations which keep the target's
+	// connection settings, see retune.
+	updates chan *targetUpdate
+
+	// primary is set by the polling loop when the server reports no
+	// replication connection, it gates heartbeat writes.
+	primary int32
+
+	sampledLag *lagSamples
+
+	// metrics holds the events of the last poll for the Prometheus
+	// endpoint.
+	metrics *metricsBuffer
+
+	// replicationResult and lagResult are the results of the last
+	// replication status queries of the polling and lag sampling loops,
+	// whose memory is reused by the next query of the same loop.
+	replicationResult *gomysql.Result
+	lagResult         *gomysql.Result
+
+	gtidChannels map[string]*gtidChannel
+	gtidPoll     uint64
+
+	binlogChannels map[string]*binlogChannel
+	binlogPoll     uint64
+
+	// binlogSizes holds the binary log file sizes of a primary at the
+	// previous poll, binlogSampled the time they were sampled.
+	binlogSizes   map[string]int64
+	binlogSampled time.Time
+}
+
+// targetUpdate is a reloaded configuration of a running target.
+type targetUpdate struct {
+	config   *targetConfig
+	settings map[string]collectorSettings
+}
+
+func newTarget(c *targetConfig, settings map[string]collectorSettings) (*target, error) {
+	tg := &target{
+		targetConfig:      c,
+		log:               log.New("target", c.name),
+		collectorSettings: make(map[string]collectorSettings),
+		updates:           make(chan *targetUpdate, 1),
+		sampledLag:        &lagSamples{samples: make(map[string]*[]float64)},
+		metrics:           new(metricsBuffer),
+		gtidChannels:      make(map[string]*gtidChannel),
+		binlogChannels:    make(map[string]*binlogChannel),
+	}
+
+	if err := tg.buildCollectors(c.collectors, settings); err != nil {
+		return nil, err
+	}
+
+	tlsConfig, err := c.tlsConfig()
+	if err != nil {
+		return nil, err
+	}
+	tg.tls = tlsConfig
+
+	return tg, nil
+}
+
+// start runs the polling loop of the target, and its heartbeat and lag
+// sampling loops when enabled.
+func (tg *target) start() {
+	t := &tg.tomb
+	metrics.register(tg.metrics)
+
+	if tg.heartbeatTable != "" {
+		t.Go(func() error { return tg.heartbeatLoop(t) })
+	}
+	if tg.lagSampleInterval > 0 {
+		t.Go(func() error { return tg.lagSampleLoop(t) })
+	}
+
+	t.Go(func() error { return tg.run(t) })
+}
+
+// stop terminates the loops of the target and waits for them to return.
+// Connections are closed first, so that loops waiting on a server which
+// does not answer return at once.
+func (tg *target) stop() {
+	tg.tomb.Kill(nil)
+	tg.conns.closeAll()
+	tg.tomb.Wait()
+	metrics.unregister(tg.metrics)
+}
+
+// update hands a reloaded configuration over to the polling loop, which
+// picks it up between two polls. It never blocks: a configuration still
+// pending is replaced, only the newest one matters.
+func (tg *target) update(u *targetUpdate) {
+	for {
+		select {
+		case tg.updates <- u:
+			return
+		default:
+		}
+
+		select {
+		case <-tg.updates:
+		default:
+		}
+	}
+}
+
+// retune applies a reloaded configuration between two polls. Only
+// settings read by the polling loop alone may change: connection,
+// heartbeat and lag sampling settings require a restart of the target.
+// Collectors whose settings did not change are kept along with their
+// state.
+func (tg *target) retune(u *targetUpdate) {
+	if err := tg.buildCollectors(u.config.collectors, u.settings); err != nil {
+		tg.log.Error("unable to retune collectors, keeping the current ones", "error", err)
+		return
+	}
+
+	tg.hostname = u.config.hostname
+	tg.tags = u.config.tags
+	tg.interval = u.config.interval
+	tg.minInterval = u.config.minInterval
+	tg.lagThreshold = u.config.lagThreshold
+	tg.delay = u.config.delay
+	tg.targetConfig.collectors = u.config.collectors
+}
+
+// buildCollectors replaces the collectors of the target, reusing current
+// instances of collectors whose settings are unchanged.
+func (tg *target) buildCollectors(names []string, settings map[string]collectorSettings) error {
+	current := make(map[string]collector, len(tg.collectors))
+	for _, c := range tg.collectors {
+		current[c.name()] = c
+	}
+
+	collectors := make([]collector, 0, len(names))
+	for _, name := range names {
+		if c, ok := current[name]; ok && reflect.DeepEqual(tg.collectorSettings[name], settings[name]) {
+			collectors = append(collectors, c)
+			continue
+		}
+
+		cs, err := newCollectors([]string{name}, settings, tg.log)
+		if err != nil {
+			return err
+		}
+		tg.log.Debug("starting collector", "collector", name)
+		collectors = append(collectors, cs[0])
+	}
+
+	tg.collectors = collectors
+	tg.collectorSettings = settings
+	return nil
+}
+
+func (tg *target) run(t *tomb.Tomb) error {
+	var (
+		db  *mysql.Conn
+		err error
+	)
+
+	defer func() {
+		if db != nil {
+			db.Close()
+		}
+	}()
+
+	tg.log.Info("starting")
+
+	pollInterval := tg.interval
+	timer := time.NewTimer(pollInterval)
+	retry := newBackoff(reconnectBackoff, tg.interval)
+	for {
+		select {
+		case <-timer.C:
+			tg.log.Debug("getting database handle")
+			if db, err = tg.getDbHandle(db); err != nil {
+				delay := retry.next()
+				tg.log.Warn("unable to get database handle", "error", err, "retry", delay)
+				timer.Reset(delay)
+				continue
+			}
+			retry.reset()
+
+			// Keep the current pace unless the poll completes
+			// and picks another one.
+			timer.Reset(pollInterval)
+
+			now := time.Now()
+
+			tg.log.Debug("gathering statistics")
+			batch := tg.queryBatch(db)
+			events, maxBehind := tg.replicationEvents(db, batch.replication, batch.replicationErr, now)
+			events = append(events, transportEvent(db, now))
+			events = append(events, tg.runCollectors(db, batch.collectors, now)...)
+
+			// Events must outlive the wait for the next poll.
+			pollInterval = tg.nextInterval(pollInterval, tg.replicationHealthy(events, maxBehind))
+			ttl := pollInterval + time.Duration(tg.delay*float64(time.Second))
+			for _, event := range events {
+				event.Ttl = float32(ttl.Seconds())
+				event.Tags = tg.tags
+				event.Host = tg.hostname
+				if event.Host == "" {
+					// Set it here rather than let the Riemann
+					// client do so, as sinks share events.
+					event.Host = localHostname
+				}
+			}
+			if !timer.Stop() {
+				<-timer.C
+			}
+			timer.Reset(pollInterval)
+
+			tg.metrics.publish(events, ttl)
+
+			sinks.publish(events)
+
+		case u := <-tg.updates:
+			tg.log.Info("retuning")
+			tg.retune(u)
+			retry = newBackoff(reconnectBackoff, tg.interval)
+
+			// Do not wait for more than the new interval.
+			if pollInterval > tg.interval {
+				pollInterval = tg.interval
+				if !timer.Stop() {
+					<-timer.C
+				}
+				timer.Reset(pollInterval)
+			}
+
+		case <-t.Dying():
+			tg.log.Info("terminating")
+			return nil
+		}
+	}
+}
+
+// replicationColumns holds the handles of the replication status columns
+// the agent reads, resolved once per result rather than by name on each
+// access of each row.
+type replicationColumns struct {
+	connectionName gomysql.Column
+	sqlRunning     gomysql.Column
+	ioRunning      gomysql.Column
+	secondsBehind  gomysql.Column
+	masterServerID gomysql.Column
+
+	masterLogFile      gomysql.Column
+	relayMasterLogFile gomysql.Column
+	readMasterLogPos   gomysql.Column
+	execMasterLogPos   gomysql.Column
+	relayLogSpace      gomysql.Column
+
+	// gtidFlavor is empty when the server does not report GTID sets.
+	gtidFlavor   string
+	gtidReceived gomysql.Column
+	gtidExecuted gomysql.Column
+}
+
+func newReplicationColumns(rs *gomysql.Resultset) *replicationColumns {
+	c := &replicationColumns{
+		connectionName:     rs.Column("Connection_name"),
+		sqlRunning:         rs.Column("Slave_SQL_Running"),
+		ioRunning:          rs.Column("Slave_IO_Running"),
+		secondsBehind:      rs.Column("Seconds_Behind_Master"),
+		masterServerID:     rs.Column("Master_Server_Id"),
+		masterLogFile:      rs.Column("Master_Log_File"),
+		relayMasterLogFile: rs.Column("Relay_Master_Log_File"),
+		readMasterLogPos:   rs.Column("Read_Master_Log_Pos"),
+		execMasterLogPos:   rs.Column("Exec_Master_Log_Pos"),
+		relayLogSpace:      rs.Column("Relay_Log_Space"),
+	}
+
+	if col := rs.Column("Gtid_IO_Pos"); col != gomysql.NoColumn {
+		c.gtidFlavor = gomysql.MariaDBFlavor
+		c.gtidReceived, c.gtidExecuted = col, rs.Column("Gtid_Slave_Pos")
+	} else if col := rs.Column("Retrieved_Gtid_Set"); col != gomysql.NoColumn {
+		c.gtidFlavor = gomysql.MySQLFlavor
+		c.gtidReceived, c.gtidExecuted = col, rs.Column("Executed_Gtid_Set")
+	}
+
+	return c
+}
+
+// replicationEvents builds the replication status events of the target,
+// along with the largest lag of its replication connections in seconds,
+// from Seconds_Behind_Master, heartbeats and lag samples.
+func (tg *target) replicationEvents(db *mysql.Conn, r *gomysql.Result, err error, t time.Time) ([]*raidman.Event, float64) {
+	var (
+		events    []*raidman.Event
+		lagAggs   map[string]lagAggregate
+		maxBehind float64
+	)
+
+	if err != nil {
+		tg.log.Warn("unable to query replication status", "error", err)
+		event := newEvent(t, "mysql/replication")
+		event.State = "unknown"
+		event.Description = fmt.Sprintf("unable to query replication status: %s", err)
+		return append(events, event), 0
+	}
+	tg.replicationResult = r
+
+	// If
+	// MariaDB [(none)]> show all slaves status;
+	// Empty set (0.000 sec)
+	// we assume is a master
+	tg.setPrimary(r.Resultset.RowNumber() == 0)
+	if r.Resultset.RowNumber() == 0 {
+		tg.log.Debug("no replication status, looks like master")
+		event := newEvent(t, "mysql/replication/master")
+		event.Description = "master OK"
+		events = append(events, event)
+		if tg.lagSampleInterval > 0 {
+			// Drop what was sampled before the role was known, so that
+			// it is not reported after a failover.
+			tg.sampledLag.reset()
+		}
+		return append(events, tg.primaryBinlogEvents(db, t)...), 0
+	}
+
+	if tg.lagSampleInterval > 0 {
+		lagAggs = tg.sampledLag.drain()
+	}
+
+	rs := r.Resultset
+	cols := newReplicationColumns(rs)
+	for i := 0; i < rs.RowNumber(); i++ {
+		event := newEvent(t, "mysql/replication/"+connectionKey(rs, i, cols.connectionName))
+
+		sqlSlaveRunning, err := rs.ColumnString(i, cols.sqlRunning)
+		if err != nil {
+			event.State = "unknown"
+			event.Description = fmt.Sprintf("unable to retrieve SQL slave state: %s", err)
+			events = append(events, event)
+			tg.log.Warn(event.Description)
+			continue
+		} else if threadState(sqlSlaveRunning) != "running" {
+			event.State = "warning"
+		}
+
+		ioSlaveRunning, err := rs.ColumnString(i, cols.ioRunning)
+		if err != nil {
+			event.State = "unknown"
+			event.Description = fmt.Sprintf("unable to retrieve IO thread state: %s", err)
+			events = append(events, event)
+			tg.log.Warn(event.Description)
+			continue
+		} else if threadState(ioSlaveRunning) != "running" {
+			event.State = "critical"
+		}
+
+		secondsBehind, err := rs.ColumnInt64(i, cols.secondsBehind)
+		if err != nil {
+			event.State = "unknown"
+			event.Description = fmt.Sprintf("unable to retrieve replication lag value: %s", err)
+			events = append(events, event)
+			tg.log.Warn(event.Description)
+			continue
+		}
+
+		tg.log.Debug("gathered",
+			"connection", strings.Split(event.Service, "/")[2],
+			"sql_thread", threadState(sqlSlaveRunning),
+			"io_thread", threadState(ioSlaveRunning),
+			"seconds_behind", secondsBehind)
+
+		event.Description = fmt.Sprintf("slave io: %s, slave sql: %s",
+			threadState(ioSlaveRunning),
+			threadState(sqlSlaveRunning))
+		event.Metric = secondsBehind
+		events = append(events, event)
+		maxBehind = math.Max(maxBehind, float64(secondsBehind))
+
+		// Heartbeats and samples catch lag spikes which
+		// Seconds_Behind_Master misses, they count towards the lag
+		// threshold as well.
+		if tg.heartbeatTable != "" {
+			e := tg.heartbeatEvent(db, rs, i, cols, event, time.Now())
+			if lag, ok := e.Metric.(float64); ok {
+				maxBehind = math.Max(maxBehind, lag)
+			}
+			events = append(events, e)
+		}
+
+		if tg.lagSampleInterval > 0 {
+			if key, err := tg.lagSampleKey(rs, i, cols); err == nil {
+				if agg, ok := lagAggs[key]; ok {
+					maxBehind = math.Max(maxBehind, agg.max)
+					events = append(events, lagSampleEvent(agg, event))
+				}
+			}
+		}
+
+		if e := tg.gtidEvent(rs, i, cols, event); e != nil {
+			events = append(events, e)
+		}
+
+		events = append(events, tg.binlogEvents(rs, i, cols, event, t)...)
+	}
+	tg.pruneGTIDChannels()
+	tg.pruneBinlogChannels()
+
+	return events, maxBehind
+}
+
+// nextInterval returns the interval to wait before the next poll: the
+// min_interval floor while replication is unhealthy, then backing off
+// twofold per healthy poll up to the configured interval.
+func (tg *target) nextInterval(current time.Duration, healthy bool) time.Duration {
+	if tg.minInterval == 0 || tg.minInterval >= tg.interval {
+		return tg.interval
+	}
+
+	if !healthy {
+		return tg.minInterval
+	}
+
+	if current *= 2; current > tg.interval {
+		current = tg.interval
+	}
+	return current
+}
+
+// replicationHealthy reports whether the IO and SQL threads of all
+// replication connections are ok, and no connection lags by more than
+// lag_threshold seconds. Failures to gather other replication events,
+// such as heartbeats or GTID sets, say nothing of replication health.
+func (tg *target) replicationHealthy(events []*raidman.Event, maxBehind float64) bool {
+	if maxBehind > float64(tg.lagThreshold) {
+		return false
+	}
+
+	for _, event := range events {
+		if event.State == "ok" || !strings.HasPrefix(event.Service, "mysql/replication/") {
+			continue
+		}
+
+		// Connection events are mysql/replication/<connection>.
+		sub := event.Service[len("mysql/replication/"):]
+		if strings.IndexByte(sub, '/') < 0 {
+			return false
+		}
+	}
+
+	return true
+}
+
+// localSockets are the usual locations of the default server socket.
+var localSockets = []string{
+	"/run/mysqld/mysqld.sock",
+	"/var/run/mysqld/mysqld.sock",
+	"/var/lib/mysql/mysql.sock",
+	"/tmp/mysql.sock",
+}
+
+var (
+	errTargetStopped = errors.New("target stopped")
+	errNoAddress     = errors.New("no address to connect to")
+)
+
+// localHostname is the host of events of targets without a hostname.
+var localHostname, _ = os.Hostname()
+
+// Delays between two connection attempts of a target loop grow from
+// reconnectBackoff up to the polling interval for the polling loop, and
+// up to maxReconnectBackoff for the heartbeat and lag sampling loops.
+const (
+	reconnectBackoff    = time.Second
+	maxReconnectBackoff = time.Second * 30
+)
+
+// getDbHandle returns db if it is still alive, or a new connection to the
+// target. New connections are dialed within the global dial concurrency
+// limit, and connect_timeout bounds both dialing and the handshake.
+func (tg *target) getDbHandle(db *mysql.Conn) (*mysql.Conn, error) {
+	if db != nil {
+		if err := tg.setDeadline(db); err != nil {
+			db.Close()
+			return nil, err
+		}
+
+		if err := db.Ping(); err != nil {
+			db.Close()
+			return nil, err
+		}
+
+		return db, nil
+	}
+
+	release, ok := dials.acquire(tg.tomb.Dying())
+	if !ok {
+		return nil, errTargetStopped
+	}
+	defer release()
+
+	addrs := tg.addrs()
+	if len(addrs) == 0 {
+		return nil, errNoAddress
+	}
+
+	dialer := &net.Dialer{Timeout: tg.connectTimeout}
+
+	var err error
+	for _, addr := range addrs {
+		if db, err = mysql.ConnectWithDialer(context.Background(), "", addr,
+			tg.mysqlUser, tg.mysqlPassword, tg.mysqlDatabase, mysql.Dialer(tg.conns.dialer(dialer.DialContext)), tg.handshake); err != nil {
+			// The server key may have changed with a restart.
+			tg.serverKey.set(nil)
+			tg.log.Debug("unable to connect", "addr", addr, "error", err)
+			continue
+		}
+		tg.serverKey.set(db.ServerPubKey())
+
+		if err = tg.setDeadline(db); err != nil {
+			db.Close()
+			return nil, err
+		}
+
+		tg.log.Debug("connected", "transport", db.RemoteAddr().Network(), "addr", addr)
+		return db, nil
+	}
+
+	return nil, err
+}
+
+// handshake sets up the authentication state of a new connection from
+// the previous ones. TLS and compression are not used over Unix sockets,
+// which are local.
+func (tg *target) handshake(db *mysql.Conn) {
+	db.SetDeadline(time.Now().Add(tg.connectTimeout))
+	if db.RemoteAddr().Network() != "unix" {
+		if tg.tls != nil {
+			db.SetTLSConfig(tg.tls)
+		}
+		if tg.compress {
+			db.SetCapability(gomysql.CLIENT_COMPRESS)
+		}
+	}
+	db.SetServerPubKey(tg.serverKey.get())
+	db.SetCapability(gomysql.CLIENT_MULTI_STATEMENTS | gomysql.CLIENT_MULTI_RESULTS)
+}
+
+// addrs returns the addresses to connect to in order of preference: the
+// Unix socket, then TCP. As with the mysql client, a target on localhost
+// with the default port is reached through the default socket when it
+// exists, while 127.0.0.1 forces TCP.
+func (tg *target) addrs() []string {
+	var addrs []string
+
+	switch {
+	case tg.mysqlSocket != "":
+		addrs = append(addrs, tg.mysqlSocket)
+
+	case tg.mysqlHost == "localhost" && tg.mysqlPort == "3306":
+		for _, path := range localSockets {
+			if fi, err := os.Stat(path); err == nil && fi.Mode()&os.ModeSocket != 0 {
+				addrs = append(addrs, path)
+				break
+			}
+		}
+	}
+
+	if tg.mysqlHost != "" {
+		addrs = append(addrs, net.JoinHostPort(tg.mysqlHost, tg.mysqlPort))
+	}
+
+	return addrs
+}
+
+// transportEvent reports the transport of the polling connection.
+func transportEvent(db *mysql.Conn, t time.Time) *raidman.Event {
+	addr := db.RemoteAddr()
+
+	event := newEvent(t, "mysql/transport")
+	event.Description = fmt.Sprintf("connected to %s over %s", addr, addr.Network())
+	event.Attributes = map[string]string{"transport": addr.Network()}
+	return event
+}
+
+// setDeadline bounds the queries issued on db until the next call to the
+// target's timeout, so that a stuck server does not stall its loops.
+func (tg *target) setDeadline(db *mysql.Conn) error {
+	if tg.timeout == 0 {
+		return db.SetDeadline(time.Time{})
+	}
+
+	return db.SetDeadline(time.Now().Add(tg.timeout))
+}
@@ -0,0 +1,71 @@
+package main
+
+import (
+	"crypto/rsa"
+	"crypto/tls"
+	"crypto/x509"
+	"fmt"
+	"io/ioutil"
+	"sync"
+)
+
+// tlsSessionCache is shared by the TLS configurations of all targets, so
+// that reconnections resume TLS sessions instead of running full
+// handshakes. Sessions are keyed by server name.
+var tlsSessionCache = tls.NewLRUClientSessionCache(0)
+
+// tlsConfig builds the TLS configuration of the target, or nil when TLS
+// is disabled.
+func (c *targetConfig) tlsConfig() (*tls.Config, error) {
+	if c.tls == "" {
+		return nil, nil
+	}
+
+	config := &tls.Config{
+		ServerName:         c.mysqlHost,
+		InsecureSkipVerify: c.tls == "skip-verify",
+		ClientSessionCache: tlsSessionCache,
+	}
+
+	if c.tlsCA != "" {
+		pem, err := ioutil.ReadFile(c.tlsCA)
+		if err != nil {
+			return nil, err
+		}
+
+		config.RootCAs = x509.NewCertPool()
+		if !config.RootCAs.AppendCertsFromPEM(pem) {
+			return nil, fmt.Errorf("no certificate found in %s", c.tlsCA)
+		}
+	}
+
+	if c.tlsCert != "" || c.tlsKey != "" {
+		cert, err := tls.LoadX509KeyPair(c.tlsCert, c.tlsKey)
+		if err != nil {
+			return nil, err
+		}
+		config.Certificates = []tls.Certificate{cert}
+	}
+
+	return config, nil
+}
+
+// serverKey remembers the RSA public key of a server across connections,
+// which saves a round-trip on caching_sha2_password full authentication
+// over insecure connections.
+type serverKey struct {
+	sync.Mutex
+	pub *rsa.PublicKey
+}
+
+func (k *serverKey) get() *rsa.PublicKey {
+	k.Lock()
+	defer k.Unlock()
+	return k.pub
+}
+
+func (k *serverKey) set(pub *rsa.PublicKey) {
+	k.Lock()
+	k.pub = pub
+	k.Unlock()
+}
@@ -0,0 +1,169 @@
+package main
+
+import (
+	"sort"
+	"strings"
+	"time"
+
+	"github.com/amir/raidman"
+	mysql "github.com/siddontang/go-mysql/client"
+	"gopkg.in/inconshreveable/log15.v2"
+)
+
+// Both queries return the role, channel, state and time in state of each
+// replication applier thread. MariaDB parallel workers are a pool shared
+// by all connections, so they are reported under an empty channel.
+const (
+	workersMariadbQuery = "SELECT IF(COMMAND = 'Slave_worker', 'worker', 'coordinator'), '', STATE, TIME " +
+		"FROM information_schema.PROCESSLIST WHERE COMMAND IN ('Slave_worker', 'Slave_SQL')"
+	workersMysqlQuery = "SELECT 'worker', w.CHANNEL_NAME, t.PROCESSLIST_STATE, t.PROCESSLIST_TIME " +
+		"FROM performance_schema.replication_applier_status_by_worker w " +
+		"JOIN performance_schema.threads t ON t.THREAD_ID = w.THREAD_ID " +
+		"UNION ALL SELECT 'coordinator', c.CHANNEL_NAME, t.PROCESSLIST_STATE, t.PROCESSLIST_TIME " +
+		"FROM performance_schema.replication_applier_status_by_coordinator c " +
+		"JOIN performance_schema.threads t ON t.THREAD_ID = c.THREAD_ID"
+)
+
+var (
+	// Worker states waiting for the coordinator to hand out work.
+	workerIdleStates = []string{
+		"Waiting for work from SQL thread",
+		"Waiting for an event from Coordinator",
+	}
+	// Worker states waiting on commit ordering with other workers.
+	workerOrderingStates = []string{
+		"Waiting for prior transaction",
+		"Waiting for preceding transaction",
+		"Waiting for dependent transaction",
+	}
+	// Coordinator states blocked on full worker queues.
+	coordinatorQueueFullStates = []string{
+		"Waiting for room in worker thread event queue",
+		"Waiting for Slave Workers to free pending events",
+		"Waiting for replica workers to free pending events",
+	}
+)
+
+type workerStats struct {
+	workers   int64
+	busy      int64
+	ordering  int64
+	slowest   int64
+	queueFull int64
+}
+
+type workersCollector struct {
+	log     log15.Logger
+	mariadb *bool
+}
+
+func newWorkersCollector(settings collectorSettings, logger log15.Logger) (collector, error) {
+	return &workersCollector{log: logger}, noSettings(settings)
+}
+
+func (c *workersCollector) name() string {
+	return "workers"
+}
+
+func (c *workersCollector) collect(db *mysql.Conn, t time.Time) ([]*raidman.Event, error) {
+	if c.mariadb == nil {
+		r, err := db.Execute("SELECT VERSION()")
+		if err != nil {
+			return nil, err
+		}
+		version, _ := r.Resultset.GetString(0, 0)
+		mariadb := strings.Contains(version, "MariaDB")
+		c.mariadb = &mariadb
+	}
+
+	query := workersMysqlQuery
+	if *c.mariadb {
+		query = workersMariadbQuery
+	}
+
+	r, err := db.Execute(query)
+	if err != nil {
+		return nil, err
+	}
+
+	channels := make(map[string]*workerStats)
+	for i := 0; i < r.Resultset.RowNumber(); i++ {
+		role, _ := r.Resultset.GetString(i, 0)
+		channel, _ := r.Resultset.GetString(i, 1)
+		state, _ := r.Resultset.GetString(i, 2)
+		inState, _ := r.Resultset.GetInt(i, 3)
+
+		stats, ok := channels[channel]
+		if !ok {
+			stats = new(workerStats)
+			channels[channel] = stats
+		}
+
+		if role == "coordinator" {
+			if hasAnyPrefix(state, coordinatorQueueFullStates) {
+				stats.queueFull = 1
+			}
+			continue
+		}
+
+		stats.workers++
+		if hasAnyPrefix(state, workerIdleStates) {
+			continue
+		}
+
+		stats.busy++
+		if hasAnyPrefix(state, workerOrderingStates) {
+			stats.ordering++
+		}
+		if inState > stats.slowest {
+			stats.slowest = inState
+		}
+	}
+
+	names := make([]string, 0, len(channels))
+	for channel := range channels {
+		names = append(names, channel)
+	}
+	sort.Strings(names)
+
+	var events []*raidman.Event
+	for _, channel := range names {
+		stats := channels[channel]
+		if stats.workers == 0 {
+			// Parallel replication is not enabled.
+			continue
+		}
+
+		prefix := "mysql/workers/"
+		if channel != "" {
+			prefix += channel + "/"
+		}
+
+		c.log.Debug("gathered replication workers",
+			"channel", channel,
+			"workers", stats.workers,
+			"busy", stats.busy,
+			"ordering", stats.ordering,
+			"slowest", stats.slowest,
+			"queue_full", stats.queueFull)
+
+		events = append(events,
+			newMetricEvent(t, prefix+"count", stats.workers),
+			newMetricEvent(t, prefix+"busy", stats.busy),
+			newMetricEvent(t, prefix+"utilization", float64(stats.busy)/float64(stats.workers)),
+			newMetricEvent(t, prefix+"ordering_waits", stats.ordering),
+			newMetricEvent(t, prefix+"slowest", stats.slowest),
+			newMetricEvent(t, prefix+"queue_full", stats.queueFull))
+	}
+
+	return events, nil
+}
+
+func hasAnyPrefix(s string, prefixes []string) bool {
+	for _, p := range prefixes {
+		if strings.HasPrefix(s, p) {
+			return true
+		}
+	}
+	return false
+}